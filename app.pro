@@ -0,0 +1,43 @@
+QT       += core gui
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+include(common.pri)
+include(core.pri)
+
+TARGET = tristar
+TEMPLATE = app
+
+# OS-specific metadata and stuff
+win32:RC_FILE = src/windows.rc
+
+SOURCES += \
+    src/mapscene.cpp \
+    src/maprenderer.cpp \
+    src/renderprofiler.cpp \
+    src/mainwindow.cpp \
+    src/main.cpp \
+    src/levelloader.cpp \
+    src/mapexporter.cpp \
+    src/objectwindow.cpp
+    
+HEADERS  += \
+    src/mapscene.h \
+    src/maprenderer.h \
+    src/renderprofiler.h \
+    src/mainwindow.h \
+    src/version.h \
+    src/levelloader.h \
+    src/mapexporter.h \
+    src/objectwindow.h
+    
+FORMS += \
+    src/mainwindow.ui \
+    src/objectwindow.ui
+
+RESOURCES += \
+    src/icons.qrc
+
+OTHER_FILES += \
+    src/windows.rc \
+    README.txt
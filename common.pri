@@ -0,0 +1,19 @@
+# build settings shared by every target
+
+QMAKE_CFLAGS += -std=c99
+QMAKE_CXXFLAGS += -std=c++11
+
+CONFIG += c++11
+
+# build on OS X with xcode/clang and libc++
+macx:QMAKE_CXXFLAGS += -stdlib=libc++
+
+# several projects get built from the same directory,
+# so keep their intermediate files apart
+BUILD_NAME = $$basename(_PRO_FILE_)
+BUILD_NAME = $$replace(BUILD_NAME, \.pro$, )
+
+OBJECTS_DIR = build/$$BUILD_NAME
+MOC_DIR     = build/$$BUILD_NAME
+UI_DIR      = build/$$BUILD_NAME
+RCC_DIR     = build/$$BUILD_NAME
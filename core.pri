@@ -0,0 +1,16 @@
+# include this from any project that links against the core library
+
+INCLUDEPATH += $$PWD/src
+DEPENDPATH  += $$PWD/src
+
+win32:CONFIG(release, debug|release): CORE_LIB_DIR = $$OUT_PWD/release
+else:win32:CONFIG(debug, debug|release): CORE_LIB_DIR = $$OUT_PWD/debug
+else: CORE_LIB_DIR = $$OUT_PWD
+
+LIBS += -L$$CORE_LIB_DIR -ltristarcore
+
+# PNG export uses zlib (build with DEFINES+=TRISTAR_NO_ZLIB to do without it)
+!contains(DEFINES, TRISTAR_NO_ZLIB): LIBS += -lz
+
+win32-msvc*: PRE_TARGETDEPS += $$CORE_LIB_DIR/tristarcore.lib
+else: PRE_TARGETDEPS += $$CORE_LIB_DIR/libtristarcore.a
@@ -0,0 +1,34 @@
+# map parsing core (no GUI dependencies), linked by the viewer and the tools
+
+QT       = core
+
+include(common.pri)
+
+TARGET = tristarcore
+TEMPLATE = lib
+CONFIG += staticlib
+
+SOURCES += \
+    src/arena.cpp \
+    src/compositor.cpp \
+    src/entityindex.cpp \
+    src/level.cpp \
+    src/levelcache.cpp \
+    src/pngwriter.cpp \
+    src/symbols.cpp \
+    src/texture.cpp \
+    src/xbinfile.cpp \
+    src/byteswap.cpp
+
+HEADERS += \
+    src/arena.h \
+    src/compositor.h \
+    src/entityindex.h \
+    src/level.h \
+    src/levelcache.h \
+    src/mapgrid.h \
+    src/pngwriter.h \
+    src/symbols.h \
+    src/texture.h \
+    src/xbinfile.h \
+    src/byteswap.h
@@ -0,0 +1,120 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include "arena.h"
+
+static inline char* alignUp(char *ptr, size_t align) {
+    uintptr_t addr = (uintptr_t)ptr;
+    return (char*)((addr + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+Arena::Arena(size_t blockSize)
+    : blockSize(blockSize), blocks(0), pos(0), end(0),
+      used(0), reserved(0)
+{}
+
+Arena::~Arena() {
+    while (blocks) {
+        block_t *next = blocks->next;
+        free(blocks);
+        blocks = next;
+    }
+}
+
+Arena::block_t* Arena::newBlock(size_t size) {
+    block_t *block = (block_t*)malloc(sizeof(block_t) + size);
+    Q_CHECK_PTR(block);
+    block->next = 0;
+    block->size = size;
+    reserved += size;
+    return block;
+}
+
+/*
+  Get some zeroed memory that stays valid until the next reset()
+  (align has to be a power of two)
+*/
+void* Arena::allocate(size_t size, size_t align) {
+    Q_ASSERT(align && !(align & (align - 1)));
+
+    char *ptr = alignUp(pos, align);
+    if (!pos || ptr + size > end) {
+        if (size + align > blockSize / 4) {
+            // big allocations (i.e. grid planes) get their own block, which
+            // goes after the current one so it can keep being bumped into
+            block_t *block = newBlock(size + align);
+            if (blocks) {
+                block->next = blocks->next;
+                blocks->next = block;
+            } else {
+                blocks = block;
+            }
+
+            ptr = alignUp((char*)(block + 1), align);
+            memset(ptr, 0, size);
+            used += size;
+            return ptr;
+        }
+
+        block_t *block = newBlock(blockSize);
+        block->next = blocks;
+        blocks = block;
+        pos = (char*)(block + 1);
+        end = pos + blockSize;
+        ptr = alignUp(pos, align);
+    }
+
+    pos = ptr + size;
+    memset(ptr, 0, size);
+    used += size;
+    return ptr;
+}
+
+arenastr_t Arena::copyString(const char *chars, uint length) {
+    arenastr_t str = {"", 0};
+    if (length) {
+        char *copy = (char*)allocate(length, 1);
+        memcpy(copy, chars, length);
+        str.chars = copy;
+        str.length = length;
+    }
+    return str;
+}
+
+/*
+  Free everything that's been allocated so far.
+  The biggest block is kept to bump into next time, so loading map after
+  map doesn't keep going back to the heap.
+*/
+void Arena::reset() {
+    block_t *keep = 0;
+    while (blocks) {
+        block_t *next = blocks->next;
+        if (!keep || blocks->size > keep->size) {
+            if (keep) {
+                reserved -= keep->size;
+                free(keep);
+            }
+            keep = blocks;
+        } else {
+            reserved -= blocks->size;
+            free(blocks);
+        }
+        blocks = next;
+    }
+
+    blocks = keep;
+    used = 0;
+    if (keep) {
+        keep->next = 0;
+        pos = (char*)(keep + 1);
+        end = pos + keep->size;
+    } else {
+        pos = end = 0;
+    }
+}
@@ -0,0 +1,120 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+#include <cstddef>
+#include <type_traits>
+
+// size of each ordinary arena block (anything bigger than a quarter of this
+// gets a block of its own)
+#define ARENA_BLOCK_SIZE (64 << 10)
+
+// a string whose bytes (UTF-8) live in an Arena
+struct arenastr_t {
+    const char *chars;
+    uint length;
+
+    bool isEmpty() const { return !length; }
+
+    QString toString() const { return QString::fromUtf8(chars, length); }
+    // (doesn't copy; only valid for as long as the arena is)
+    QByteArray bytes() const { return QByteArray::fromRawData(chars, length); }
+};
+
+/*
+  A fixed-size array allocated from an Arena.
+  Copying one just copies the pointer; the items themselves go away when
+  the arena is reset.
+*/
+template <typename type> class ArenaArray {
+public:
+    ArenaArray() : items(0), count(0) {}
+    ArenaArray(type *items, int count) : items(items), count(count) {}
+
+    int size() const     { return count; }
+    bool isEmpty() const { return !count; }
+
+    type& operator[](int i)             { return items[i]; }
+    const type& operator[](int i) const { return items[i]; }
+
+    type* data()                   { return items; }
+    const type* data() const       { return items; }
+    const type* constData() const  { return items; }
+
+    type* begin()             { return items; }
+    type* end()               { return items + count; }
+    const type* begin() const { return items; }
+    const type* end() const   { return items + count; }
+
+private:
+    type *items;
+    int count;
+};
+
+/*
+  Monotonic allocator for everything a level owns.
+  Memory is handed out from large blocks and is never freed piece by piece;
+  reset() throws away everything at once, keeping the largest block around
+  for the next level to reuse. Nothing allocated here has its destructor
+  run, so only trivially destructible types can be stored in it.
+
+  Not thread-safe: allocate up front, then let threads fill in what was
+  allocated (or serialize allocations some other way).
+*/
+class Arena {
+public:
+    explicit Arena(size_t blockSize = ARENA_BLOCK_SIZE);
+    ~Arena();
+
+    void* allocate(size_t size, size_t align = sizeof(void*));
+
+    // zero-initialized array of count items
+    // (ArenaArray sizes are ints, so anything bigger than that is refused)
+    template <typename type> ArenaArray<type> allocArray(uint count, size_t align = Q_ALIGNOF(type)) {
+        Q_STATIC_ASSERT(std::is_trivially_destructible<type>::value);
+        Q_ASSERT(count <= INT_MAX);
+        if (!count || count > INT_MAX)
+            return ArenaArray<type>();
+        return ArenaArray<type>((type*)allocate(sizeof(type) * (size_t)count, align), count);
+    }
+
+    arenastr_t copyString(const char*, uint length);
+    arenastr_t copyString(const QByteArray &bytes) {
+        return copyString(bytes.constData(), bytes.size());
+    }
+    arenastr_t copyString(const QString &str) {
+        return copyString(str.toUtf8());
+    }
+
+    void reset();
+
+    // total size of everything allocated / of all blocks
+    size_t bytesUsed() const     { return used; }
+    size_t bytesReserved() const { return reserved; }
+
+private:
+    Q_DISABLE_COPY(Arena)
+
+    struct block_t {
+        block_t *next;
+        size_t size;
+    };
+
+    block_t* newBlock(size_t size);
+
+    size_t blockSize;
+    // most recent ordinary block first (the one being bumped into)
+    block_t *blocks;
+    char *pos, *end;
+
+    size_t used, reserved;
+};
+
+#endif // ARENA_H
@@ -0,0 +1,173 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#include <QtGlobal>
+#include <cstring>
+#include "byteswap.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BYTESWAP_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 is only built in with compilers that can target it per-function
+#if defined(BYTESWAP_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define BYTESWAP_AVX2
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+/*
+  scalar kernels (also used for whatever is left over after the SIMD ones)
+*/
+static void swap16Scalar(u8 *dst, const u8 *src, size_t count) {
+    for (size_t i = 0; i < count; i++, dst += 2, src += 2) {
+        u8 b0 = src[0], b1 = src[1];
+        dst[0] = b1;
+        dst[1] = b0;
+    }
+}
+
+static void swap32Scalar(u8 *dst, const u8 *src, size_t count) {
+    for (size_t i = 0; i < count; i++, dst += 4, src += 4) {
+        u8 b0 = src[0], b1 = src[1], b2 = src[2], b3 = src[3];
+        dst[0] = b3;
+        dst[1] = b2;
+        dst[2] = b1;
+        dst[3] = b0;
+    }
+}
+
+#ifdef BYTESWAP_SSE2
+/*
+  SSE2 kernels (8 or 4 words per iteration; SSE2 has no byte shuffle so the
+  bytes are swapped with shifts)
+*/
+static inline __m128i swapWords16(__m128i v) {
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+static void swap16SSE2(u8 *dst, const u8 *src, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + 2*i));
+        _mm_storeu_si128((__m128i*)(dst + 2*i), swapWords16(v));
+    }
+    swap16Scalar(dst + 2*i, src + 2*i, count - i);
+}
+
+static void swap32SSE2(u8 *dst, const u8 *src, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + 4*i));
+        // swap the 16-bit halves of each word, then the bytes of each half
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128((__m128i*)(dst + 4*i), swapWords16(v));
+    }
+    swap32Scalar(dst + 4*i, src + 4*i, count - i);
+}
+#endif
+
+#ifdef BYTESWAP_AVX2
+/*
+  AVX2 kernels (16 or 8 words per iteration)
+*/
+TARGET_AVX2 static void swapBytesAVX2(u8 *dst, const u8 *src, size_t bytes,
+                                      __m256i mask) {
+    size_t i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(v, mask));
+    }
+}
+
+TARGET_AVX2 static void swap16AVX2(u8 *dst, const u8 *src, size_t count) {
+    const __m256i mask = _mm256_setr_epi8(
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t done = count & ~(size_t)15;
+    swapBytesAVX2(dst, src, 2 * done, mask);
+    swap16SSE2(dst + 2*done, src + 2*done, count - done);
+}
+
+TARGET_AVX2 static void swap32AVX2(u8 *dst, const u8 *src, size_t count) {
+    const __m256i mask = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t done = count & ~(size_t)7;
+    swapBytesAVX2(dst, src, 4 * done, mask);
+    swap32SSE2(dst + 4*done, src + 4*done, count - done);
+}
+#endif
+
+/*
+  kernel selection (done once, the first time anything gets decoded)
+*/
+typedef void (*swapfunc_t)(u8*, const u8*, size_t);
+
+struct swapkernel_t {
+    const char *name;
+    swapfunc_t swap16, swap32;
+};
+
+static swapkernel_t selectKernel() {
+#ifdef BYTESWAP_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        swapkernel_t kernel = {"avx2", swap16AVX2, swap32AVX2};
+        return kernel;
+    }
+#endif
+#ifdef BYTESWAP_SSE2
+    swapkernel_t kernel = {"sse2", swap16SSE2, swap32SSE2};
+#else
+    swapkernel_t kernel = {"scalar", swap16Scalar, swap32Scalar};
+#endif
+    return kernel;
+}
+
+static const swapkernel_t& kernel() {
+    static const swapkernel_t theKernel = selectKernel();
+    return theKernel;
+}
+
+static inline bool needSwap(bool bigEndian) {
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    return !bigEndian;
+#else
+    return bigEndian;
+#endif
+}
+
+void decode16(void *dst, const void *src, size_t count, bool bigEndian) {
+    if (needSwap(bigEndian))
+        kernel().swap16((u8*)dst, (const u8*)src, count);
+    else
+        memcpy(dst, src, 2 * count);
+}
+
+void decode32(void *dst, const void *src, size_t count, bool bigEndian) {
+    if (needSwap(bigEndian))
+        kernel().swap32((u8*)dst, (const u8*)src, count);
+    else
+        memcpy(dst, src, 4 * count);
+}
+
+void swap16(void *dst, const void *src, size_t count) {
+    kernel().swap16((u8*)dst, (const u8*)src, count);
+}
+
+void swap32(void *dst, const void *src, size_t count) {
+    kernel().swap32((u8*)dst, (const u8*)src, count);
+}
+
+const char* byteswapKernel() {
+    return kernel().name;
+}
@@ -0,0 +1,50 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef BYTESWAP_H
+#define BYTESWAP_H
+
+#include <QtGlobal>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+  Bulk conversion of arrays of 16/32-bit words stored in the file's byte order
+  into native byte order. Unaligned source/destination pointers are fine.
+
+  When the byte order already matches, this is just a memcpy; otherwise the
+  words are swapped with AVX2 or SSE2 kernels if the CPU has them, or with
+  plain scalar code if it doesn't.
+*/
+void decode16(void *dst, const void *src, size_t count, bool bigEndian);
+void decode32(void *dst, const void *src, size_t count, bool bigEndian);
+
+// unconditionally swap each word
+void swap16(void *dst, const void *src, size_t count);
+void swap32(void *dst, const void *src, size_t count);
+
+/*
+  Same as above, but with the file's byte order known at compile time,
+  so each one boils down to either a memcpy or a swap kernel.
+*/
+template <bool bigEndian> inline void decode16(void *dst, const void *src, size_t count) {
+    if (bigEndian != (Q_BYTE_ORDER == Q_BIG_ENDIAN))
+        swap16(dst, src, count);
+    else
+        memcpy(dst, src, 2 * count);
+}
+
+template <bool bigEndian> inline void decode32(void *dst, const void *src, size_t count) {
+    if (bigEndian != (Q_BYTE_ORDER == Q_BIG_ENDIAN))
+        swap32(dst, src, count);
+    else
+        memcpy(dst, src, 4 * count);
+}
+
+// name of the swap kernel currently in use ("avx2", "sse2" or "scalar")
+const char* byteswapKernel();
+
+#endif // BYTESWAP_H
@@ -0,0 +1,211 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#include <QtGlobal>
+#include "compositor.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COMPOSITE_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 is only built in with compilers that can target it per-function
+#if defined(COMPOSITE_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define COMPOSITE_AVX2
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// most layers that can be composited at once
+#define MAX_LAYERS 16
+
+typedef void (*rowfunc_t)(uint32_t *dst, const uint8_t *const *rows,
+                          const uint32_t *const *palettes, uint32_t numLayers,
+                          uint32_t begin, uint32_t end);
+
+/*
+  scalar kernel (also used for whatever is left over after the SIMD ones)
+
+  Source-over with premultiplied alpha:
+      dst = src + dst * (255 - src.alpha) / 255
+  with the division rounded as (x + 128 + ((x + 128) >> 8)) >> 8, which is
+  exact for every x in 0..255*255 and cheap to do in 16-bit SIMD lanes.
+*/
+static inline uint32_t blendPixel(uint32_t dst, uint32_t src) {
+    uint32_t inv = 255 - (src >> 24);
+    uint32_t out = 0;
+
+    for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t x = ((dst >> shift) & 0xFF) * inv + 128;
+        x = (x + (x >> 8)) >> 8;
+        uint32_t c = ((src >> shift) & 0xFF) + x;
+        out |= qMin<uint32_t>(c, 255) << shift;
+    }
+    return out;
+}
+
+static void compositeRowScalar(uint32_t *dst, const uint8_t *const *rows,
+                               const uint32_t *const *palettes, uint32_t numLayers,
+                               uint32_t begin, uint32_t end) {
+    for (uint32_t x = begin; x < end; x++) {
+        uint32_t pixel = 0;
+        for (uint32_t i = 0; i < numLayers; i++)
+            pixel = blendPixel(pixel, palettes[i][rows[i][x]]);
+        dst[x] = pixel;
+    }
+}
+
+#ifdef COMPOSITE_SSE2
+/*
+  SSE2 kernel (4 pixels per iteration; SSE2 has no gather, so palette
+  lookups are done one at a time and only the blending is vectorized)
+*/
+static inline __m128i blendSSE2(__m128i dst, __m128i src) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c128 = _mm_set1_epi16(128);
+
+    // 255 - alpha, in both 16-bit halves of each pixel
+    __m128i inv = _mm_srli_epi32(src, 24);
+    inv = _mm_or_si128(inv, _mm_slli_epi32(inv, 16));
+    inv = _mm_sub_epi16(_mm_set1_epi16(255), inv);
+
+    // ...then in all four channels of each pixel, for two pixels at a time
+    __m128i invLo = _mm_unpacklo_epi32(inv, inv);
+    __m128i invHi = _mm_unpackhi_epi32(inv, inv);
+
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), invLo);
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), invHi);
+    lo = _mm_add_epi16(lo, c128);
+    hi = _mm_add_epi16(hi, c128);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+    return _mm_adds_epu8(src, _mm_packus_epi16(lo, hi));
+}
+
+static void compositeRowSSE2(uint32_t *dst, const uint8_t *const *rows,
+                             const uint32_t *const *palettes, uint32_t numLayers,
+                             uint32_t begin, uint32_t end) {
+    uint32_t x = begin;
+    for (; x + 4 <= end; x += 4) {
+        __m128i pixels = _mm_setzero_si128();
+        for (uint32_t i = 0; i < numLayers; i++) {
+            const uint8_t *row = rows[i] + x;
+            const uint32_t *palette = palettes[i];
+            __m128i src = _mm_setr_epi32(palette[row[0]], palette[row[1]],
+                                         palette[row[2]], palette[row[3]]);
+            pixels = blendSSE2(pixels, src);
+        }
+        _mm_storeu_si128((__m128i*)(dst + x), pixels);
+    }
+    compositeRowScalar(dst, rows, palettes, numLayers, x, end);
+}
+#endif
+
+#ifdef COMPOSITE_AVX2
+/*
+  AVX2 kernel (8 pixels per iteration, with gathered palette lookups)
+  (the unpacks/packs work within each 128-bit lane, but since they're
+   always paired up the pixels end up back where they started)
+*/
+TARGET_AVX2 static inline __m256i blendAVX2(__m256i dst, __m256i src) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i c128 = _mm256_set1_epi16(128);
+
+    __m256i inv = _mm256_srli_epi32(src, 24);
+    inv = _mm256_or_si256(inv, _mm256_slli_epi32(inv, 16));
+    inv = _mm256_sub_epi16(_mm256_set1_epi16(255), inv);
+
+    __m256i invLo = _mm256_unpacklo_epi32(inv, inv);
+    __m256i invHi = _mm256_unpackhi_epi32(inv, inv);
+
+    __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(dst, zero), invLo);
+    __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(dst, zero), invHi);
+    lo = _mm256_add_epi16(lo, c128);
+    hi = _mm256_add_epi16(hi, c128);
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+
+    return _mm256_adds_epu8(src, _mm256_packus_epi16(lo, hi));
+}
+
+TARGET_AVX2 static void compositeRowAVX2(uint32_t *dst, const uint8_t *const *rows,
+                                         const uint32_t *const *palettes, uint32_t numLayers,
+                                         uint32_t begin, uint32_t end) {
+    uint32_t x = begin;
+    for (; x + 8 <= end; x += 8) {
+        __m256i pixels = _mm256_setzero_si256();
+        for (uint32_t i = 0; i < numLayers; i++) {
+            __m128i bytes = _mm_loadl_epi64((const __m128i*)(rows[i] + x));
+            __m256i index = _mm256_cvtepu8_epi32(bytes);
+            __m256i src = _mm256_i32gather_epi32((const int*)palettes[i], index, 4);
+            pixels = blendAVX2(pixels, src);
+        }
+        _mm256_storeu_si256((__m256i*)(dst + x), pixels);
+    }
+    compositeRowSSE2(dst, rows, palettes, numLayers, x, end);
+}
+#endif
+
+/*
+  kernel selection (done once, the first time anything gets composited)
+*/
+struct compkernel_t {
+    const char *name;
+    rowfunc_t row;
+};
+
+static compkernel_t selectKernel() {
+#ifdef COMPOSITE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        compkernel_t kernel = {"avx2", compositeRowAVX2};
+        return kernel;
+    }
+#endif
+#ifdef COMPOSITE_SSE2
+    compkernel_t kernel = {"sse2", compositeRowSSE2};
+#else
+    compkernel_t kernel = {"scalar", compositeRowScalar};
+#endif
+    return kernel;
+}
+
+static const compkernel_t& kernel() {
+    static const compkernel_t theKernel = selectKernel();
+    return theKernel;
+}
+
+static void composite(rowfunc_t func, uint32_t *dst, size_t dstStride,
+                      uint32_t width, uint32_t height,
+                      const complayer_t *layers, uint32_t numLayers) {
+    Q_ASSERT(numLayers <= MAX_LAYERS);
+    numLayers = qMin<uint32_t>(numLayers, MAX_LAYERS);
+
+    const uint8_t *rows[MAX_LAYERS];
+    const uint32_t *palettes[MAX_LAYERS];
+    for (uint32_t i = 0; i < numLayers; i++)
+        palettes[i] = layers[i].palette;
+
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t i = 0; i < numLayers; i++)
+            rows[i] = layers[i].indices + y * layers[i].stride;
+        func(dst + y * dstStride, rows, palettes, numLayers, 0, width);
+    }
+}
+
+void compositeLayers(uint32_t *dst, size_t dstStride, uint32_t width, uint32_t height,
+                     const complayer_t *layers, uint32_t numLayers) {
+    composite(kernel().row, dst, dstStride, width, height, layers, numLayers);
+}
+
+void compositeLayersScalar(uint32_t *dst, size_t dstStride, uint32_t width, uint32_t height,
+                           const complayer_t *layers, uint32_t numLayers) {
+    composite(compositeRowScalar, dst, dstStride, width, height, layers, numLayers);
+}
+
+const char* compositorKernel() {
+    return kernel().name;
+}
@@ -0,0 +1,41 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <cstddef>
+#include <cstdint>
+
+// number of entries in each layer's palette (so any index byte is valid)
+#define COMPOSITE_PALETTE_SIZE 256
+
+// one layer of indexed pixels to be composited
+struct complayer_t {
+    const uint8_t *indices;  // one palette index per pixel
+    size_t stride;           // bytes from one row to the next
+    const uint32_t *palette; // premultiplied ARGB32, COMPOSITE_PALETTE_SIZE entries
+};
+
+/*
+  Composite a stack of indexed layers (bottom to top) into one buffer of
+  premultiplied ARGB32 pixels, in a single pass over the output.
+  Every pixel gets the same amount of work whichever layers are opaque or
+  transparent there, and the output starts out transparent.
+  (dstStride is in pixels, not bytes)
+
+  compositeLayers uses AVX2 or SSE2 kernels if the CPU has them;
+  compositeLayersScalar is the plain C version, which the SIMD kernels have
+  to match exactly.
+*/
+void compositeLayers(uint32_t *dst, size_t dstStride, uint32_t width, uint32_t height,
+                     const complayer_t *layers, uint32_t numLayers);
+void compositeLayersScalar(uint32_t *dst, size_t dstStride, uint32_t width, uint32_t height,
+                           const complayer_t *layers, uint32_t numLayers);
+
+// name of the compositing kernel currently in use ("avx2", "sse2" or "scalar")
+const char* compositorKernel();
+
+#endif // COMPOSITOR_H
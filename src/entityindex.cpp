@@ -0,0 +1,221 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#include <cmath>
+#include "entityindex.h"
+#include "level.h"
+
+EntityIndex::EntityIndex()
+    : indexedKinds(0), cellsWide(0), cellsHigh(0)
+{}
+
+void EntityIndex::clear() {
+    indexedKinds = 0;
+    cellsWide = cellsHigh = 0;
+    cellStart.clear();
+    entries.clear();
+}
+
+/*
+  Entity coordinates are in 1/16ths of a tile, with the Y axis going up
+*/
+template <typename T>
+static inline QPointF entityPosition(const T &entity, uint levelHeight) {
+    return QPointF(entity.x / 16.0, levelHeight - entity.y / 16.0);
+}
+
+QPointF EntityIndex::position(const LevelData &level, const entityref_t &ref) {
+    switch (ref.kind) {
+    case EntityObject:
+        return entityPosition(level.objects()[ref.index], level.height);
+    case EntityItem:
+        return entityPosition(level.items()[ref.index], level.height);
+    case EntityEnemy:
+        return entityPosition(level.enemies()[ref.index], level.height);
+    default:
+        return QPointF();
+    }
+}
+
+symbol_t EntityIndex::name(const LevelData &level, const entityref_t &ref) {
+    static const symbol_t itemName = internSymbol("Item");
+
+    // (type indices come straight from the file, so they might be bogus)
+    switch (ref.kind) {
+    case EntityObject: {
+        uint type = level.objects()[ref.index].type;
+        if (type >= (uint)level.objectNames().size())
+            return NO_SYMBOL;
+        return level.objectNames()[type];
+    }
+    case EntityEnemy: {
+        int type = level.enemies()[ref.index].type;
+        if (type < 0 || type >= level.enemyTypes().size())
+            return NO_SYMBOL;
+        return level.enemyTypes()[type].name;
+    }
+    default:
+        return itemName;
+    }
+}
+
+uint EntityIndex::cellX(qreal x) const {
+    return qBound(0, (int)floor(x / ENTITY_CELL_SIZE), (int)cellsWide - 1);
+}
+
+uint EntityIndex::cellY(qreal y) const {
+    return qBound(0, (int)floor(y / ENTITY_CELL_SIZE), (int)cellsHigh - 1);
+}
+
+/*
+  Index the objects, items and/or enemies on a map
+  (which loads them, if they haven't been already)
+*/
+void EntityIndex::build(const LevelData &level, uint kinds) {
+    clear();
+    indexedKinds = kinds & ALL_ENTITIES;
+
+    uint counts[NumEntityKinds] = {
+        (kinds & (1 << EntityObject)) ? (uint)level.objects().size() : 0,
+        (kinds & (1 << EntityItem))   ? (uint)level.items().size()   : 0,
+        (kinds & (1 << EntityEnemy))  ? (uint)level.enemies().size() : 0
+    };
+    uint total = counts[0] + counts[1] + counts[2];
+    if (!total)
+        return;
+
+    cellsWide = qMax(1u, (level.width + ENTITY_CELL_SIZE - 1) / ENTITY_CELL_SIZE);
+    cellsHigh = qMax(1u, (level.height + ENTITY_CELL_SIZE - 1) / ENTITY_CELL_SIZE);
+
+    // find out where everything is and which cell it goes in...
+    QVector<entry_t> unsorted(total);
+    QVector<uint> cells(total);
+    uint n = 0;
+    for (uint kind = 0; kind < NumEntityKinds; kind++) {
+        for (uint i = 0; i < counts[kind]; i++, n++) {
+            entry_t &entry = unsorted[n];
+            entry.ref.kind = (EntityKind)kind;
+            entry.ref.index = i;
+
+            QPointF pos = position(level, entry.ref);
+            entry.x = pos.x();
+            entry.y = pos.y();
+            cells[n] = cellY(pos.y()) * cellsWide + cellX(pos.x());
+        }
+    }
+
+    // ...then lay each cell's entries out one after another
+    // (keeping them in their original order within each cell)
+    cellStart.fill(0, cellsWide * cellsHigh + 1);
+    for (uint i = 0; i < total; i++)
+        cellStart[cells[i] + 1]++;
+    for (int i = 1; i < cellStart.size(); i++)
+        cellStart[i] += cellStart[i - 1];
+
+    QVector<uint> next(cellStart);
+    entries.resize(total);
+    for (uint i = 0; i < total; i++)
+        entries[next[cells[i]]++] = unsorted[i];
+}
+
+QVector<entityref_t> EntityIndex::inRect(const QRectF &rect, uint kinds) const {
+    QVector<entityref_t> found;
+    if (entries.isEmpty() || rect.isEmpty())
+        return found;
+
+    uint left   = cellX(rect.left());
+    uint right  = cellX(rect.right());
+    uint top    = cellY(rect.top());
+    uint bottom = cellY(rect.bottom());
+
+    for (uint cy = top; cy <= bottom; cy++) {
+        uint begin = cellStart[cy * cellsWide + left];
+        uint end   = cellStart[cy * cellsWide + right + 1];
+
+        // (the cells in each row are next to each other)
+        for (uint i = begin; i < end; i++) {
+            const entry_t &entry = entries[i];
+            if ((kinds & (1 << entry.ref.kind))
+                    && rect.contains(entry.x, entry.y))
+                found.append(entry.ref);
+        }
+    }
+
+    return found;
+}
+
+QVector<entityref_t> EntityIndex::onTile(int x, int y, uint kinds) const {
+    QVector<entityref_t> found;
+    if (entries.isEmpty())
+        return found;
+
+    // (entities on the edge between two tiles only count for one of them)
+    uint cell = cellY(y) * cellsWide + cellX(x);
+    for (uint i = cellStart[cell]; i < cellStart[cell + 1]; i++) {
+        const entry_t &entry = entries[i];
+        if ((kinds & (1 << entry.ref.kind))
+                && floor(entry.x) == x && floor(entry.y) == y)
+            found.append(entry.ref);
+    }
+
+    return found;
+}
+
+/*
+  Look through rings of cells around the one the point is in, until the
+  next ring is too far away to have anything closer than what's been found.
+  (anything off the edge of the map is in an edge cell, but that can only
+  be further away from the point than the cell itself, so it still works)
+*/
+bool EntityIndex::nearest(const QPointF &point, qreal maxDistance, entityref_t &found,
+                          uint kinds) const {
+    if (entries.isEmpty())
+        return false;
+
+    int px = cellX(point.x());
+    int py = cellY(point.y());
+    int maxRing = qMax(cellsWide, cellsHigh);
+
+    qreal bestDistance = maxDistance * maxDistance;
+    bool any = false;
+
+    for (int ring = 0; ring <= maxRing; ring++) {
+        // (the closest anything in this ring can be)
+        qreal ringDistance = qMax(0, ring - 1) * ENTITY_CELL_SIZE;
+        if (ringDistance * ringDistance > bestDistance)
+            break;
+
+        int top    = qMax(py - ring, 0);
+        int bottom = qMin(py + ring, (int)cellsHigh - 1);
+        for (int cy = top; cy <= bottom; cy++) {
+            // (only the cells on the ring's edge, not the ones inside it)
+            bool edgeRow = (cy == py - ring || cy == py + ring);
+            int step = (edgeRow || ring == 0) ? 1 : 2 * ring;
+
+            for (int cx = px - ring; cx <= px + ring; cx += step) {
+                if (cx < 0 || cx >= (int)cellsWide)
+                    continue;
+
+                uint cell = cy * cellsWide + cx;
+                for (uint i = cellStart[cell]; i < cellStart[cell + 1]; i++) {
+                    const entry_t &entry = entries[i];
+                    if (!(kinds & (1 << entry.ref.kind)))
+                        continue;
+
+                    qreal dx = entry.x - point.x();
+                    qreal dy = entry.y - point.y();
+                    qreal distance = dx * dx + dy * dy;
+                    if (distance <= bestDistance) {
+                        bestDistance = distance;
+                        found = entry.ref;
+                        any = true;
+                    }
+                }
+            }
+        }
+    }
+
+    return any;
+}
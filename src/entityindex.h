@@ -0,0 +1,88 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef ENTITYINDEX_H
+#define ENTITYINDEX_H
+
+#include <QPointF>
+#include <QRectF>
+#include <QVector>
+
+#include "symbols.h"
+
+struct LevelData;
+
+// kinds of entities on a map (and bits for selecting them in queries)
+enum EntityKind {
+    EntityObject,
+    EntityItem,
+    EntityEnemy,
+    NumEntityKinds
+};
+
+#define ALL_ENTITIES ((1 << NumEntityKinds) - 1)
+
+// one entity: its kind and its place in LevelData::objects()/items()/enemies()
+struct entityref_t {
+    EntityKind kind;
+    uint index;
+};
+
+// size of each cell of an entity index (in tiles)
+#define ENTITY_CELL_SIZE 8
+
+/*
+  Uniform grid over the positions of a map's entities, for finding the ones
+  in some part of the map (or the one closest to some point) without
+  looking at all of them.
+
+  Positions are in tiles, measured from the top left of the map (the map
+  data itself has the Y axis going up). Entities are bucketed into cells of
+  ENTITY_CELL_SIZE tiles, with the buckets all stored in one array;
+  anything outside the map goes in the nearest cell on its edge.
+  Queries only ever find the kinds of entities that were indexed.
+*/
+class EntityIndex {
+public:
+    EntityIndex();
+
+    // (only the given kinds are indexed, and only those get loaded)
+    void build(const LevelData&, uint kinds = ALL_ENTITIES);
+    void clear();
+    bool isEmpty() const { return entries.isEmpty(); }
+    // which kinds of entities were indexed
+    uint kinds() const { return indexedKinds; }
+
+    // where an entity is (in tiles)
+    static QPointF position(const LevelData&, const entityref_t&);
+    // what an entity is labeled with (its object/enemy type, or just "Item")
+    static symbol_t name(const LevelData&, const entityref_t&);
+
+    // every entity (of the given kinds) inside an area of the map
+    QVector<entityref_t> inRect(const QRectF &rect, uint kinds = ALL_ENTITIES) const;
+    // every entity (of the given kinds) on one tile
+    QVector<entityref_t> onTile(int x, int y, uint kinds = ALL_ENTITIES) const;
+    // the entity (of the given kinds) closest to a point, if there's one
+    // within maxDistance tiles of it
+    bool nearest(const QPointF &point, qreal maxDistance, entityref_t &found,
+                 uint kinds = ALL_ENTITIES) const;
+
+private:
+    struct entry_t {
+        entityref_t ref;
+        float x, y;
+    };
+
+    uint indexedKinds;
+    uint cellsWide, cellsHigh;
+    // entries in cell n are entries[cellStart[n]] up to entries[cellStart[n+1]]
+    QVector<uint> cellStart;
+    QVector<entry_t> entries;
+
+    uint cellX(qreal x) const;
+    uint cellY(qreal y) const;
+};
+
+#endif // ENTITYINDEX_H
@@ -1,333 +1,732 @@
 #include <QFile>
-#include <QtEndian>
-#include <QMessageBox>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <cstring>
+#include <functional>
 #include "level.h"
+#include "xbinfile.h"
+
+// (chunks may be decoded on different threads)
+static QMutex logMutex;
+
+/*
+  Records how long it took to decode a layer or entity table
+  (see LevelData::decodeStats)
+*/
+class DecodeTimer {
+public:
+    DecodeTimer(QVector<decodestat_t> &stats, const char *name, quint64 bytes)
+        : stats(stats), name(name), bytes(bytes)
+    {
+        timer.start();
+    }
+
+    ~DecodeTimer() {
+        decodestat_t stat = {name, bytes, timer.nsecsElapsed()};
+        QMutexLocker lock(&logMutex);
+        stats.push_back(stat);
+    }
 
-#define CHUNK_TABLE 0x14
+private:
+    QVector<decodestat_t> &stats;
+    const char *name;
+    quint64 bytes;
+    QElapsedTimer timer;
+};
+
+typedef void (LevelData::*chunkloader_t)(const XBinFile&, uint);
+
+/*
+  Decodes a set of independent chunks at the same time on the global thread
+  pool. A chunk that can't get a thread right away (e.g. because the pool is
+  already busy opening other maps) is decoded on the calling thread instead,
+  so waiting never depends on work that hasn't started yet.
+*/
+class ChunkTasks {
+public:
+    ChunkTasks(LoadProgress *progress, uint total)
+        : progress(progress), total(total), started(0) {}
+    ~ChunkTasks() { wait(); }
+
+    void load(LevelData *level, chunkloader_t loader, const XBinFile *xbin, uint chunk) {
+        run([=] {
+            if (progress && progress->isCanceled())
+                return;
+
+            (level->*loader)(*xbin, chunk);
+
+            if (progress)
+                progress->chunkLoaded(loaded.fetchAndAddOrdered(1) + 1, total);
+        });
+    }
 
-// TODO: spin this shit into an actual file class like KALE/KDCE have
-bool bigEndian = false;
+    void run(const std::function<void()> &func) {
+        Task *task = new Task(func, &done);
+        if (QThreadPool::globalInstance()->tryStart(task)) {
+            started++;
+        } else {
+            func();
+            delete task;
+        }
+    }
 
-typedef uint16_t u16;
-typedef int16_t i16;
-typedef uint32_t u32;
-typedef int32_t i32;
+    void wait() {
+        done.acquire(started);
+        started = 0;
+    }
 
-template <typename type> type readNum(QFile &file) {
-    type num;
-    file.read((char*)&num, sizeof(type));
+private:
+    class Task : public QRunnable {
+    public:
+        Task(const std::function<void()> &func, QSemaphore *done)
+            : func(func), done(done) {}
 
-    if (bigEndian)
-        return qFromBigEndian<type>((uchar*)&num);
+        void run() {
+            func();
+            done->release();
+        }
 
-    return qFromLittleEndian<type>((uchar*)&num);
+    private:
+        std::function<void()> func;
+        QSemaphore *done;
+    };
+
+    LoadProgress *progress;
+    uint total;
+    QAtomicInt loaded;
+
+    QSemaphore done;
+    int started;
+};
+
+struct chunkload_t {
+    chunkloader_t loader;
+    uint chunk;
+};
+
+// most grid chunks any kind of map has
+#define MAX_GRID_CHUNKS 4
+
+/*
+  Everything that differs between the kinds of maps we know about.
+  Supporting another kind of map should only take another entry in the
+  table in findSchema() (plus new chunk loaders, if it needs any).
+*/
+struct LevelData::mapschema_t {
+    MapFormat format;
+    // does this file look like this kind of map?
+    bool (*matches)(const XBinFile&);
+    // get the width/height that all of the layers share
+    void (*dimensions)(const XBinFile&, uint &width, uint &height);
+    // chunks that make up the grid, decoded right away and all at once
+    // (up to the first null loader)
+    chunkload_t gridChunks[MAX_GRID_CHUNKS];
+    // everything else, decoded on demand (in LazyChunk order, with a null
+    // loader for anything this kind of map doesn't have)
+    chunkload_t lazyChunks[NumLazyChunks];
+};
+
+/*
+  Check for a file with the given byte order whose chunk table ends at
+  the given chunk
+*/
+template <bool bigEndian, uint endChunk>
+static bool hasChunkTable(const XBinFile &xbin) {
+    return xbin.isBigEndian() == bigEndian
+        && xbin.cursor<bigEndian>().chunkOffset(endChunk) == 0x12345678;
 }
 
-uint chunkOffset(QFile &file, uint chunk) {
-    file.seek(CHUNK_TABLE + (4 * chunk));
-    return readNum<u32>(file);
+/*
+  Get the map size from the layer at the start of a chunk...
+*/
+template <bool bigEndian, uint chunk>
+static void sizeAtChunk(const XBinFile &xbin, uint &width, uint &height) {
+    XBinCursor<bigEndian> cursor = xbin.cursor<bigEndian>();
+    cursor.seekChunk(chunk);
+    width = cursor.read32();
+    height = cursor.read32();
 }
 
-void seekChunk(QFile& file, uint chunk) {
-    file.seek(chunkOffset(file, chunk));
+/*
+  ...or from the layer pointed to from somewhere in a chunk
+*/
+template <bool bigEndian, uint chunk, uint offset>
+static void sizeAtPointer(const XBinFile &xbin, uint &width, uint &height) {
+    XBinCursor<bigEndian> cursor = xbin.cursor<bigEndian>();
+    cursor.seekChunk(chunk);
+    cursor.skip(offset);
+    cursor.seek(cursor.read32());
+    width = cursor.read32();
+    height = cursor.read32();
 }
 
-void LevelData::loadBreakable(QFile &file, uint chunk) {
+template <bool bigEndian>
+static inline void readCells(XBinCursor<bigEndian> &cursor, int16_t *dst, uint count) {
+    cursor.readWords16(dst, count);
+}
 
-    seekChunk(file, chunk);
-    // read width/height
-    uint width = readNum<u32>(file);
-    uint height = readNum<u32>(file);
+template <bool bigEndian>
+static inline void readCells(XBinCursor<bigEndian> &cursor, uint32_t *dst, uint count) {
+    cursor.readWords32(dst, count);
+}
 
-    this->width = width;
-    this->height = height;
+template <bool bigEndian>
+static inline void readCells(XBinCursor<bigEndian> &cursor, visual_t *dst, uint count) {
+    // each cell is a (tile, flags) pair of 16-bit words
+    Q_STATIC_ASSERT(sizeof(visual_t) == 4);
+    cursor.readWords16(dst, 2 * count);
+}
+
+/*
+  Decode a whole layer into one of the grid's planes.
+  Rows are stored bottom to top, and are decoded straight into the plane
+  unless this layer's dimensions don't match the rest of the map, in which
+  case they're clamped to fit.
+  Returns false (leaving the plane alone) if the layer's dimensions say it
+  runs past the end of the file.
+*/
+template <bool bigEndian, typename type>
+static bool readLayer(XBinCursor<bigEndian> &cursor, LayerPlane<type> &plane, uint width, uint height) {
+    // (the dimensions come from the file, so don't trust them any further
+    //  than the file actually goes)
+    if ((quint64)width * height * sizeof(type) > cursor.bytesLeft())
+        return false;
+
+    QVector<type> temp;
 
-    this->blocks.resize(height);
-    // read info
     for (int y = height - 1; y >= 0; y--) {
-        this->blocks[y].resize(width);
-        for (uint x = 0; x < width; x++) {
-            this->blocks[y][x].breakable = readNum<i16>(file);
+        bool inside = (uint)y < plane.height();
+
+        if (inside && width == plane.width()) {
+            readCells(cursor, plane.row(y), width);
+        } else {
+            temp.resize(width);
+            readCells(cursor, temp.data(), width);
+            if (inside)
+                memcpy(plane.row(y), temp.constData(),
+                       sizeof(type) * qMin(width, plane.width()));
         }
     }
+
+    return true;
 }
 
-void LevelData::loadCollision(QFile &file, uint chunk) {
+template <bool bigEndian>
+void LevelData::loadBreakable(const XBinFile &xbin, uint chunk) {
+    XBinCursor<bigEndian> cursor = xbin.cursor<bigEndian>();
 
-    seekChunk(file, chunk);
+    cursor.seekChunk(chunk);
+    // read width/height
+    uint width = cursor.read32();
+    uint height = cursor.read32();
+
+    // is there a mismatch between the width/height given here and elsewhere?
+    if (width != this->width || height != this->height)
+        warning(QString::asprintf("data1 size mismatch: (%u, %u) != (%u, %u)",
+                                  this->width, this->height, width, height));
+
+    // read info
+    DecodeTimer timer(this->decodeStatList, "breakable", 2 * (quint64)width * height);
+    if (!readLayer(cursor, this->blocks.breakables(), width, height))
+        warning(QString::asprintf("data1 runs past the end of the file (%u, %u)", width, height));
+}
+
+template <bool bigEndian>
+void LevelData::loadCollision(const XBinFile &xbin, uint chunk) {
+    XBinCursor<bigEndian> cursor = xbin.cursor<bigEndian>();
+
+    cursor.seekChunk(chunk);
     // read pointer
-    uint ptr = readNum<u32>(file);
-    file.seek(ptr);
+    uint ptr = cursor.read32();
+    cursor.seek(ptr);
     // read info
-    uint width = readNum<u32>(file);
-    uint height = readNum<u32>(file);
+    uint width = cursor.read32();
+    uint height = cursor.read32();
 
     // is there a mismatch between the width/height given here and elsewhere?
     if (width != this->width || height != this->height)
-        printf("data3 size mismatch: (%u, %u) != (%u, %u)\n",
-               this->width, this->height, width, height);
+        warning(QString::asprintf("data3 size mismatch: (%u, %u) != (%u, %u)",
+                                  this->width, this->height, width, height));
 
-    for (int y = height - 1; y >= 0; y--) {
-         for (uint x = 0; x < width; x++) {
-             this->blocks[y][x].collision = readNum<u32>(file);
-         }
-    }
+    DecodeTimer timer(this->decodeStatList, "collision", 4 * (quint64)width * height);
+    if (!readLayer(cursor, this->blocks.collisions(), width, height))
+        warning(QString::asprintf("data3 runs past the end of the file (%u, %u)", width, height));
 }
 
-void LevelData::loadCollisionRTDL(QFile &file, uint chunk) {
+template <bool bigEndian>
+void LevelData::loadCollisionRTDL(const XBinFile &xbin, uint chunk) {
+    XBinCursor<bigEndian> cursor = xbin.cursor<bigEndian>();
 
-    seekChunk(file, chunk);
+    cursor.seekChunk(chunk);
 
     // dunno what these are
     // (this is the only difference between this part and its
     //  corresponding part in Triple Deluxe)
-    printf("RTDL chunk 3 unknown = 0x%X\n", readNum<u32>(file));
+    warning(QString::asprintf("RTDL chunk 3 unknown = 0x%X", cursor.read32()));
 
     // read pointer
-    uint ptr = readNum<u32>(file);
-    file.seek(ptr);
+    uint ptr = cursor.read32();
+    cursor.seek(ptr);
 
     // read info
-    uint width = readNum<u32>(file);
-    uint height = readNum<u32>(file);
-
-    // do this here since it's the first chunk read for RTDL right now
-    this->width = width;
-    this->height = height;
-    this->blocks.resize(height);
+    uint width = cursor.read32();
+    uint height = cursor.read32();
 
     // is there a mismatch between the width/height given here and elsewhere?
     if (width != this->width || height != this->height)
-        printf("data3 size mismatch: (%u, %u) != (%u, %u)\n",
-               this->width, this->height, width, height);
-
-    for (int y = height - 1; y >= 0; y--) {
-        // do this here too for now
-        this->blocks[y].resize(width);
-        for (uint x = 0; x < width; x++) {
-            uint tileInfo = readNum<u32>(file);
-            // i don't know how this shit works but this should at least give
-            // us something to look at (pretty sure it's a bitfield but it doesn't
-            // work the same way as TDX's collision data does for drawing purposes
-            // but this might give us the same sort of view...
-            this->blocks[y][x].collision = tileInfo >> 24;
-
-            // and this (TODO: read the actual breakable data from somewhere)
-            this->blocks[y][x].breakable = -1;
-        }
-    }
+        warning(QString::asprintf("data3 size mismatch: (%u, %u) != (%u, %u)",
+                                  this->width, this->height, width, height));
+
+    // (big-endian, so this is where bulk swapping helps the most)
+    DecodeTimer timer(this->decodeStatList, "collision", 4 * (quint64)width * height);
+    LayerPlane<uint32_t> &collision = this->blocks.collisions();
+    if (!readLayer(cursor, collision, width, height))
+        warning(QString::asprintf("data3 runs past the end of the file (%u, %u)", width, height));
+
+    // i don't know how this shit works but this should at least give
+    // us something to look at (pretty sure it's a bitfield but it doesn't
+    // work the same way as TDX's collision data does for drawing purposes
+    // but this might give us the same sort of view...
+    // (the plane's own size, not the header's, in case they don't match)
+    uint32_t *tileInfo = collision.data();
+    for (size_t i = 0; i < collision.count(); i++)
+        tileInfo[i] >>= 24;
+
+    // and this (TODO: read the actual breakable data from somewhere)
+    this->blocks.breakables().fill(-1);
 }
 
-void LevelData::loadVisual(QFile &file, uint chunk) {
+template <bool bigEndian>
+void LevelData::loadVisual(const XBinFile &xbin, uint chunk) {
+    XBinCursor<bigEndian> cursor = xbin.cursor<bigEndian>();
     uint ptrs[3];
 
-    seekChunk(file, chunk);
+    cursor.seekChunk(chunk);
     // get two unknown values
-    this->unknown1 = readNum<u32>(file);
-    this->unknown2 = readNum<u32>(file);
-    printf("chunk 4 unknown 1 = 0x%X unknown 2 = 0x%X\n", this->unknown1, this->unknown2);
+    this->unknown1 = cursor.read32();
+    this->unknown2 = cursor.read32();
+    warning(QString::asprintf("chunk 4 unknown 1 = 0x%X unknown 2 = 0x%X",
+                              this->unknown1, this->unknown2));
     // get pointers to body
-    ptrs[0] = readNum<u32>(file);
-    ptrs[1] = readNum<u32>(file);
-    ptrs[2] = readNum<u32>(file);
+    ptrs[0] = cursor.read32();
+    ptrs[1] = cursor.read32();
+    ptrs[2] = cursor.read32();
     // get data
     for (uint i = 0; i < 3; i++) {
-        file.seek(ptrs[i]);
-        uint width = readNum<u32>(file);
-        uint height = readNum<u32>(file);
+        cursor.seek(ptrs[i]);
+        uint width = cursor.read32();
+        uint height = cursor.read32();
 
         // is there a mismatch between the width/height given here and elsewhere?
         if (width != this->width || height != this->height)
-            printf("data4 size mismatch (body %u): (%u, %u) != (%u, %u)\n",
-                   i, this->width, this->height, width, height);
-
-        this->blocks.resize(height);
-        for (int y = height - 1; y >= 0; y--) {
-             for (uint x = 0; x < width && this->width; x++) {
-                 this->blocks[y].resize(width);
-                 this->blocks[y][x].visual[i].first = readNum<i16>(file);
-                 this->blocks[y][x].visual[i].second = readNum<u16>(file);
-             }
-        }
+            warning(QString::asprintf("data4 size mismatch (body %u): (%u, %u) != (%u, %u)",
+                                      i, this->width, this->height, width, height));
+
+        static const char* const names[3] = {"visual 0", "visual 1", "visual 2"};
+        DecodeTimer timer(this->decodeStatList, names[i], 4 * (quint64)width * height);
+        if (!readLayer(cursor, this->blocks.visuals(i), width, height))
+            warning(QString::asprintf("data4 body %u runs past the end of the file (%u, %u)",
+                                      i, width, height));
     }
 
 }
 
-void LevelData::loadEnemies(QFile &file, uint chunk) {
+template <bool bigEndian>
+void LevelData::loadEnemies(const XBinFile &xbin, uint chunk) {
+    XBinCursor<bigEndian> cursor = xbin.cursor<bigEndian>();
 
-    seekChunk(file, chunk);
-    uint count = readNum<u32>(file);
-    for (uint i = 0; i < count; i++) {
-        enemy_t enemy;
+    cursor.seekChunk(chunk);
+    uint count = cursor.read32();
+
+    // name pointer + 8 values per enemy
+    const uint recordSize = 9;
+    // (don't trust the count any further than the file actually goes)
+    count = qMin<uint>(count, cursor.bytesLeft() / (4 * recordSize));
+    DecodeTimer timer(this->decodeStatList, "enemies", 4 * (quint64)recordSize * count);
+    QVector<u32> table(recordSize * (size_t)count);
+    cursor.readWords32(table.data(), table.size());
 
-        // save position, read name
-        uint namePtr = readNum<u32>(file);
-        uint tempPtr = file.pos();
-        file.seek(namePtr);
-        uint size = readNum<u32>(file);
-        enemy.name = file.read(size);
+    this->enemyList = this->arena.allocArray<enemy_t>(count);
+    for (uint i = 0; i < count; i++) {
+        const u32 *record = table.constData() + (i * (size_t)recordSize);
+        enemy_t &enemy = this->enemyList[i];
 
-        // seek back
-        file.seek(tempPtr);
+        enemy.name = internSymbol(cursor.stringAt(record[0]));
 
         // TODO: update with known fields
-        enemy.data1[0] = readNum<i32>(file);
-        enemy.data1[1] = readNum<i32>(file);
-        enemy.data1[2] = readNum<i32>(file);
-
-        enemy.type = readNum<i32>(file);
-        enemy.x = readNum<i32>(file);
-        enemy.y = readNum<i32>(file);
+        enemy.data1[0] = record[1];
+        enemy.data1[1] = record[2];
+        enemy.data1[2] = record[3];
 
-        enemy.data2[0] = readNum<i32>(file);
-        enemy.data2[1] = readNum<i32>(file);
+        enemy.type = record[4];
+        enemy.x = record[5];
+        enemy.y = record[6];
 
-        this->enemies.push_back(enemy);
+        enemy.data2[0] = record[7];
+        enemy.data2[1] = record[8];
     }
 }
 
-void LevelData::loadEnemyTypes(QFile &file, uint chunk) {
+template <bool bigEndian>
+void LevelData::loadEnemyTypes(const XBinFile &xbin, uint chunk) {
+    XBinCursor<bigEndian> cursor = xbin.cursor<bigEndian>();
 
-    seekChunk(file, chunk);
-    uint count = readNum<u32>(file);
+    cursor.seekChunk(chunk);
+    uint count = cursor.read32();
+    // (name and state pointers, 8 bytes per type)
+    count = qMin<uint>(count, cursor.bytesLeft() / 8);
+    this->enemyTypeList = this->arena.allocArray<enemytype_t>(count);
     for (uint i = 0; i < count; i++) {
-        enemytype_t type;
+        enemytype_t &type = this->enemyTypeList[i];
         // name pointer
-        uint namePtr = readNum<u32>(file);
+        type.name = internSymbol(cursor.stringAt(cursor.read32()));
         // state pointer
-        uint statePtr = readNum<u32>(file);
-
-        // save pos
-        uint tempPtr = file.pos();
-
-        // get name
-        file.seek(namePtr);
-        uint size = readNum<u32>(file);
-        type.name = file.read(size);
-        // get state
-        file.seek(statePtr);
-        size = readNum<u32>(file);
-        type.state = file.read(size);
-
-        this->enemyTypes.push_back(type);
-
-        // seek back
-        file.seek(tempPtr);
+        type.state = internSymbol(cursor.stringAt(cursor.read32()));
     }
 }
 
-void LevelData::loadMusic(QFile &file, uint chunk) {
+template <bool bigEndian>
+void LevelData::loadMusic(const XBinFile &xbin, uint chunk) {
+    XBinCursor<bigEndian> cursor = xbin.cursor<bigEndian>();
 
     // TODO: other stuff besides filename, maybe
-    seekChunk(file, chunk);
-    uint ptr = readNum<u32>(file);
-    file.seek(ptr);
-    uint count= readNum<u32>(file);
-    this->musicName = file.read(count);
+    cursor.seekChunk(chunk);
+    uint ptr = cursor.read32();
+    this->music = this->arena.copyString(cursor.stringAt(ptr));
 }
 
-void LevelData::loadObjects(QFile &file, uint chunk) {
+template <bool bigEndian>
+void LevelData::loadObjects(const XBinFile &xbin, uint chunk) {
+    XBinCursor<bigEndian> cursor = xbin.cursor<bigEndian>();
 
-    seekChunk(file, chunk);
-    uint objListPtr = readNum<u32>(file);
-    uint nameListPtr = readNum<u32>(file);
+    cursor.seekChunk(chunk);
+    uint objListPtr = cursor.read32();
+    uint nameListPtr = cursor.read32();
     // object table
-    file.seek(objListPtr);
-    uint count = readNum<u32>(file);
+    cursor.seek(objListPtr);
+    uint count = cursor.read32();
 
-    this->objects.resize(count);
-    for (uint i = 0; i < count; i++) {
-        // TODO: update with known fields
-        this->objects[i].x = readNum<u32>(file);
-        this->objects[i].y = readNum<u32>(file);
-        this->objects[i].type = readNum<u32>(file);
+    // objects are just 13 32-bit values each, so decode them in one go
+    // TODO: update with known fields
+    Q_STATIC_ASSERT(sizeof(object_t) == 13 * 4);
+    count = qMin<uint>(count, cursor.bytesLeft() / sizeof(object_t));
+    DecodeTimer timer(this->decodeStatList, "objects", (quint64)sizeof(object_t) * count);
 
-        this->objects[i].unknown = readNum<i32>(file);
-        this->objects[i].enabled = readNum<i32>(file);
+    this->objectList = this->arena.allocArray<object_t>(count);
+    cursor.readWords32(this->objectList.data(), 13 * count);
 
-        for (uint j = 0; j < 8; j++) {
-            this->objects[i].params[j] = readNum<i32>(file);
-        }
-    }
     // object names
-    file.seek(nameListPtr);
-    count = readNum<u32>(file);
+    cursor.seek(nameListPtr);
+    count = cursor.read32();
+    count = qMin<uint>(count, cursor.bytesLeft() / 4);
 
-    this->objectNames.resize(count);
+    QVector<u32> namePtrs(count);
+    cursor.readWords32(namePtrs.data(), count);
+
+    this->objectNameList = this->arena.allocArray<symbol_t>(count);
     for (uint i = 0; i < count; i++) {
-        uint namePtr = readNum<u32>(file);
-        uint tempPtr = file.pos();
-        file.seek(namePtr);
-        uint size = readNum<u32>(file);
-        this->objectNames[i] = file.read(size);
-        file.seek(tempPtr);
+        this->objectNameList[i] = internSymbol(cursor.stringAt(namePtrs[i]));
     }
 }
 
-void LevelData::loadItems(QFile &file, uint chunk) {
+template <bool bigEndian>
+void LevelData::loadItems(const XBinFile &xbin, uint chunk) {
+    XBinCursor<bigEndian> cursor = xbin.cursor<bigEndian>();
 
-    seekChunk(file, chunk);
-    uint count = readNum<u32>(file);
-    this->items.resize(count);
-    for (uint i = 0; i < count; i++) {
-        for (uint j = 0; j < 3; j++) {
-            this->items[i].data[j] = readNum<i32>(file);
-        }
-        this->items[i].x = readNum<u32>(file);
-        this->items[i].y = readNum<u32>(file);
-        this->items[i].data2 = readNum<u32>(file);
-    }
+    cursor.seekChunk(chunk);
+    uint count = cursor.read32();
+
+    // same deal as objects (6 32-bit values each)
+    Q_STATIC_ASSERT(sizeof(item_t) == 6 * 4);
+    count = qMin<uint>(count, cursor.bytesLeft() / sizeof(item_t));
+    DecodeTimer timer(this->decodeStatList, "items", (quint64)sizeof(item_t) * count);
+
+    this->itemList = this->arena.allocArray<item_t>(count);
+    cursor.readWords32(this->itemList.data(), 6 * count);
 }
 
-bool LevelData::open(QFile& file) {
+bool LevelData::open(QFile& file, LoadProgress *progress) {
     this->clear();
 
-    file.seek(4);
-    bigEndian = file.read(2) == "\x12\x34";
+    if (!xbin.open(file.fileName())) {
+        this->error = ErrorRead;
+        return false;
+    }
+
+    // check magic
+    if (xbin.size() < CHUNK_TABLE || memcmp(xbin.data(), "XBIN", 4)) {
+        xbin.close();
+        this->error = ErrorNotMap;
+        return false;
+    }
+
+    const mapschema_t *schema = findSchema(xbin);
+    if (!schema) {
+        xbin.close();
+        this->error = ErrorFormat;
+        return false;
+    }
+    this->format = schema->format;
+
+    // the layers all share the same width/height, so get that first
+    // so that the grid is all set up before any chunks are decoded
+    uint width, height;
+    schema->dimensions(xbin, width, height);
+
+    // (every tile takes at least 2 bytes in every layer)
+    if ((quint64)width * height * 2 > xbin.size()) {
+        xbin.close();
+        this->error = ErrorDimensions;
+        return false;
+    }
+
+    this->width = width;
+    this->height = height;
+    this->blocks.resize(width, height, this->arena);
+
+    // now decode each chunk on its own thread
+    // (they all write to different parts of the level, so they don't need
+    //  to synchronize with each other)
+    const chunkload_t *chunks = schema->gridChunks;
+    uint numChunks = 0;
+    while (numChunks < MAX_GRID_CHUNKS && chunks[numChunks].loader)
+        numChunks++;
+
+    ChunkTasks tasks(progress, numChunks);
+    for (uint i = 0; i < numChunks; i++)
+        tasks.load(this, chunks[i].loader, &xbin, chunks[i].chunk);
+    tasks.wait();
+
+    if (progress && progress->isCanceled()) {
+        this->clear();
+        this->error = ErrorCanceled;
+        return false;
+    }
+
+    // the rest of the chunks are decoded later (see ensureLoaded)
+    this->schema = schema;
+    this->lazyLoaded.storeRelease(0);
+
+    return true;
+}
 
-    if (!bigEndian && chunkOffset(file, 9) == 0x12345678) {
+/*
+  Map a file again for a level that came from somewhere else (i.e. the
+  cache), so that the chunks that weren't there can still be decoded on
+  demand. Fails if the file isn't the same kind of map as the level.
+*/
+bool LevelData::reopen(QFile &file) {
+    if (!xbin.open(file.fileName()))
+        return false;
+
+    const mapschema_t *schema = 0;
+    if (xbin.size() >= CHUNK_TABLE && !memcmp(xbin.data(), "XBIN", 4))
+        schema = findSchema(xbin);
+    if (!schema || schema->format != this->format) {
+        xbin.close();
+        return false;
+    }
+
+    this->schema = schema;
+    return true;
+}
+
+/*
+  Figure out what kind of map a file is.
+*/
+const LevelData::mapschema_t* LevelData::findSchema(const XBinFile &xbin) {
+    static const mapschema_t schemas[] = {
         // main game map
-        loadBreakable(file, 0);
-        // TODO: check if map data 2 is ever actually used
-        loadCollision(file, 2);
-        loadVisual(file, 3);
-        loadEnemies(file, 4);
-        loadEnemyTypes(file, 5);
-        loadMusic(file, 6);
-        loadObjects(file, 7);
-        loadItems(file, 8);
-    } else if (!bigEndian && chunkOffset(file, 5) == 0x12345678) {
+        {FormatTDX, &hasChunkTable<false, 9>, &sizeAtChunk<false, 0>,
+         {{&LevelData::loadBreakable<false>, 0},
+          // TODO: check if map data 2 is ever actually used
+          {&LevelData::loadCollision<false>, 2},
+          {&LevelData::loadVisual<false>, 3}},
+         {{&LevelData::loadMusic<false>, 6},
+          {&LevelData::loadEnemies<false>, 4},
+          {&LevelData::loadEnemyTypes<false>, 5},
+          {&LevelData::loadObjects<false>, 7},
+          {&LevelData::loadItems<false>, 8}}},
+
         // Kirby Fighters map
-        loadBreakable(file, 0);
-        loadCollision(file, 1);
-        loadVisual(file, 2);
-        loadMusic(file, 3);
-        loadObjects(file, 4);
-    } else if (bigEndian && chunkOffset(file, 9) == 0x12345678) {
+        {FormatFighters, &hasChunkTable<false, 5>, &sizeAtChunk<false, 0>,
+         {{&LevelData::loadBreakable<false>, 0},
+          {&LevelData::loadCollision<false>, 1},
+          {&LevelData::loadVisual<false>, 2}},
+         {{&LevelData::loadMusic<false>, 3},
+          {0, 0},
+          {0, 0},
+          {&LevelData::loadObjects<false>, 4},
+          {0, 0}}},
+
         // Return to Dream Land map
-        // just a test...
-        loadCollisionRTDL(file, 2);
-        loadVisual(file, 4);
-    } else {
-        QMessageBox::critical(0, "Load Map", "Unrecognized map format.",
-                              QMessageBox::Ok);
-        return false;
+        // just a test... (size comes from collision instead of breakable blocks)
+        {FormatRTDL, &hasChunkTable<true, 9>, &sizeAtPointer<true, 2, 4>,
+         {{&LevelData::loadCollisionRTDL<true>, 2},
+          {&LevelData::loadVisual<true>, 4}},
+         {}}
+    };
+
+    for (uint i = 0; i < sizeof(schemas) / sizeof(mapschema_t); i++) {
+        if (schemas[i].matches(xbin))
+            return &schemas[i];
     }
+    return 0;
+}
 
-    fflush(stdout);
-    return true;
+/*
+  Decode one of the non-grid chunks if it hasn't been decoded yet.
+  This only takes a lock the first time each chunk is asked for.
+*/
+void LevelData::ensureLoaded(LazyChunk which) const {
+    const int bit = 1 << which;
+    if (this->lazyLoaded.loadAcquire() & bit)
+        return;
+
+    QMutexLocker lock(&this->lazyMutex);
+    if (this->lazyLoaded.loadAcquire() & bit)
+        return;
+
+    // (this lock also keeps the loaders from allocating from the arena at
+    //  the same time)
+    if (this->schema && this->xbin.isOpen()) {
+        const chunkload_t &load = this->schema->lazyChunks[which];
+        if (load.loader) {
+            // (the decoded data is logically part of the level all along)
+            LevelData *self = const_cast<LevelData*>(this);
+            (self->*load.loader)(this->xbin, load.chunk);
+        }
+    }
+
+    // once everything has been decoded the file isn't needed anymore, so
+    // don't keep it open (and locked, on Windows) any longer than that
+    const int all = (1 << NumLazyChunks) - 1;
+    if ((this->lazyLoaded.fetchAndOrOrdered(bit) | bit) == all)
+        this->xbin.close();
+}
+
+void LevelData::loadAll() const {
+    for (uint i = 0; i < NumLazyChunks; i++)
+        ensureLoaded((LazyChunk)i);
+}
+
+QString LevelData::musicName() const {
+    ensureLoaded(LazyMusic);
+    return this->music.toString();
+}
+
+const ArenaArray<enemy_t>& LevelData::enemies() const {
+    ensureLoaded(LazyEnemies);
+    return this->enemyList;
+}
+
+const ArenaArray<enemytype_t>& LevelData::enemyTypes() const {
+    ensureLoaded(LazyEnemyTypes);
+    return this->enemyTypeList;
+}
+
+const ArenaArray<object_t>& LevelData::objects() const {
+    ensureLoaded(LazyObjects);
+    return this->objectList;
+}
+
+const ArenaArray<symbol_t>& LevelData::objectNames() const {
+    ensureLoaded(LazyObjects);
+    return this->objectNameList;
+}
+
+const ArenaArray<item_t>& LevelData::items() const {
+    ensureLoaded(LazyItems);
+    return this->itemList;
+}
+
+LevelData::LevelData() {
+    this->clear();
+}
+
+const char* LevelData::formatName() const {
+    switch (this->format) {
+    case FormatTDX:
+        return "tdx";
+    case FormatFighters:
+        return "fighters";
+    case FormatRTDL:
+        return "rtdl";
+    default:
+        return "unknown";
+    }
 }
 
 void LevelData::clear() {
+    this->format = FormatUnknown;
     this->width = 0;
     this->height = 0;
 
-    this->musicName = "";
+    this->unknown1 = 0;
+    this->unknown2 = 0;
 
+    // everything here came from the arena, so just forget about it...
+    static const arenastr_t noString = {"", 0};
+    this->music = noString;
     this->blocks.clear();
-    this->enemyTypes.clear();
-    this->enemies.clear();
-    this->objects.clear();
-    this->objectNames.clear();
-    this->items.clear();
+    this->enemyTypeList = ArenaArray<enemytype_t>();
+    this->enemyList = ArenaArray<enemy_t>();
+    this->objectList = ArenaArray<object_t>();
+    this->objectNameList = ArenaArray<symbol_t>();
+    this->itemList = ArenaArray<item_t>();
+    // ...and then free it all at once
+    this->arena.reset();
+
+    // (nothing left to decode)
+    this->xbin.close();
+    this->schema = 0;
+    this->lazyLoaded.storeRelease(0);
+
+    {
+        QMutexLocker lock(&logMutex);
+        this->decodeStatList.clear();
+        this->warningList.clear();
+    }
+    this->error = ErrorNone;
+}
+
+const char* LevelData::errorString() const {
+    switch (this->error) {
+    case ErrorNone:
+        return QT_TRANSLATE_NOOP("LevelData", "No error.");
+    case ErrorRead:
+        return QT_TRANSLATE_NOOP("LevelData", "Unable to read file.");
+    case ErrorNotMap:
+        return QT_TRANSLATE_NOOP("LevelData", "File is not a valid map.");
+    case ErrorFormat:
+        return QT_TRANSLATE_NOOP("LevelData", "Unrecognized map format.");
+    case ErrorDimensions:
+        return QT_TRANSLATE_NOOP("LevelData", "Invalid map dimensions.");
+    case ErrorCanceled:
+        return QT_TRANSLATE_NOOP("LevelData", "Canceled.");
+    default:
+        return QT_TRANSLATE_NOOP("LevelData", "Unknown error.");
+    }
+}
+
+/*
+  Note something odd about the map (safe to call from any chunk loader)
+*/
+void LevelData::warning(const QString &msg) {
+    QMutexLocker lock(&logMutex);
+    this->warningList.append(msg);
+}
+
+QVector<decodestat_t> LevelData::decodeStats() const {
+    QMutexLocker lock(&logMutex);
+    return this->decodeStatList;
+}
+
+QStringList LevelData::warnings() const {
+    QMutexLocker lock(&logMutex);
+    return this->warningList;
 }
@@ -3,30 +3,26 @@
 
 #include <QVector>
 #include <QMap>
+#include <QAtomicInt>
+#include <QMutex>
 #include <QString>
+#include <QStringList>
 #include <cstdint>
 
-class QFile;
-
-struct mapblock_t {
-    int16_t  breakable;
-    uint32_t collision;
-
-    struct {
-        int16_t  first;
-        uint16_t second;
-    } visual[3];
-};
+#include "arena.h"
+#include "mapgrid.h"
+#include "symbols.h"
+#include "xbinfile.h"
 
 struct enemy_t {
-    QString name;
+    symbol_t name;
     int32_t data1[3];
     int32_t type, x, y;
     int32_t data2[2];
 };
 
 struct enemytype_t {
-    QString name, state;
+    symbol_t name, state;
 };
 
 struct object_t {
@@ -41,36 +37,153 @@ struct item_t {
     uint32_t x, y, data2;
 };
 
+// time taken to decode a layer or entity table, for profiling purposes
+struct decodestat_t {
+    const char *name;
+    quint64 bytes;
+    qint64 nsecs;
+
+    double mbPerSec() const {
+        return nsecs > 0 ? bytes * 1000.0 / nsecs : 0;
+    }
+};
+
+/*
+  Receives progress updates while a map is being opened (possibly from
+  several threads at once), and can be used to cancel loading.
+*/
+class LoadProgress {
+public:
+    virtual ~LoadProgress() {}
+
+    virtual void chunkLoaded(uint done, uint total) = 0;
+    virtual bool isCanceled() const = 0;
+};
+
+// which game a map is from
+enum MapFormat {
+    FormatUnknown,
+    FormatTDX,      // Triple Deluxe
+    FormatFighters, // Kirby Fighters
+    FormatRTDL      // Return to Dream Land
+};
+
+// reasons that opening a map can fail
+enum LevelError {
+    ErrorNone,
+    ErrorRead,       // file couldn't be read at all
+    ErrorNotMap,     // not an XBIN file
+    ErrorFormat,     // XBIN file, but not a kind of map we know about
+    ErrorDimensions, // map size doesn't fit in the file
+    ErrorCanceled    // canceled via LoadProgress
+};
+
 struct LevelData {
+    LevelData();
+
+    MapFormat format;
     uint width, height;
-    QString musicName;
 
-    QVector<QVector<mapblock_t>> blocks;
+    // the grid planes, entity tables and all of their strings come from here
+    // (and are freed all at once by clear())
+    Arena arena;
+
+    MapGrid blocks;
 
     // from chunk 4
     uint32_t unknown1, unknown2;
 
-    QVector<enemy_t> enemies;
-    QVector<enemytype_t> enemyTypes;
+    // everything besides the grid is only decoded the first time it's asked
+    // for (these are safe to call from any thread)
+    QString musicName() const;
 
-    QVector<object_t> objects;
-    QVector<QString> objectNames;
+    const ArenaArray<enemy_t>& enemies() const;
+    const ArenaArray<enemytype_t>& enemyTypes() const;
 
-    QVector<item_t> items;
+    const ArenaArray<object_t>& objects() const;
+    const ArenaArray<symbol_t>& objectNames() const;
 
-    bool open(QFile&);
+    const ArenaArray<item_t>& items() const;
+
+    // decode anything that hasn't been decoded yet
+    void loadAll() const;
+
+    // how long each chunk took to decode, and anything odd noticed while
+    // decoding (size mismatches, unknown values...)
+    // lazy chunks can add to these from any thread, so these return copies
+    QVector<decodestat_t> decodeStats() const;
+    QStringList warnings() const;
+
+    // reason the last call to open() failed
+    LevelError error;
+
+    /*
+      Only the name of the file is taken from the QFile (which the caller
+      can close as soon as this returns); the level maps the file again
+      itself and keeps that mapping, and so the file, open until every
+      chunk has been decoded (see loadAll) or clear() is called.
+    */
+    bool open(QFile&, LoadProgress* = 0);
     void clear();
 
+    const char* formatName() const;
+    // (untranslated; translate these in the "LevelData" context)
+    const char* errorString() const;
+
 private:
-    void loadBreakable(QFile&, uint);
-    void loadCollision(QFile&, uint);
-    void loadCollisionRTDL(QFile&, uint);
-    void loadVisual(QFile&, uint);
-    void loadEnemies(QFile&, uint);
-    void loadEnemyTypes(QFile&, uint);
-    void loadMusic(QFile&, uint);
-    void loadObjects(QFile&, uint);
-    void loadItems(QFile&, uint);
+    Q_DISABLE_COPY(LevelData)
+    friend class LevelCache;
+
+    // chunks that are decoded on demand
+    enum LazyChunk {
+        LazyMusic,
+        LazyEnemies,
+        LazyEnemyTypes,
+        LazyObjects,
+        LazyItems,
+        NumLazyChunks
+    };
+
+    // how to read each kind of map (see level.cpp)
+    struct mapschema_t;
+    static const mapschema_t* findSchema(const XBinFile&);
+
+    void ensureLoaded(LazyChunk) const;
+    bool reopen(QFile&);
+    void warning(const QString&);
+
+    // chunk loaders (one instance per byte order)
+    template <bool bigEndian> void loadBreakable(const XBinFile&, uint);
+    template <bool bigEndian> void loadCollision(const XBinFile&, uint);
+    template <bool bigEndian> void loadCollisionRTDL(const XBinFile&, uint);
+    template <bool bigEndian> void loadVisual(const XBinFile&, uint);
+    template <bool bigEndian> void loadEnemies(const XBinFile&, uint);
+    template <bool bigEndian> void loadEnemyTypes(const XBinFile&, uint);
+    template <bool bigEndian> void loadMusic(const XBinFile&, uint);
+    template <bool bigEndian> void loadObjects(const XBinFile&, uint);
+    template <bool bigEndian> void loadItems(const XBinFile&, uint);
+
+    // the map stays mapped for as long as there's anything left to decode
+    // (and is closed as soon as there isn't)
+    mutable XBinFile xbin;
+    const mapschema_t *schema;
+    // bitmask of lazy chunks that have already been decoded
+    mutable QAtomicInt lazyLoaded;
+    mutable QMutex lazyMutex;
+
+    // (only touched with logMutex held, see level.cpp)
+    QVector<decodestat_t> decodeStatList;
+    QStringList warningList;
+
+    arenastr_t music;
+
+    ArenaArray<enemy_t> enemyList;
+    ArenaArray<enemytype_t> enemyTypeList;
+
+    ArenaArray<object_t> objectList;
+    ArenaArray<symbol_t> objectNameList;
+
+    ArenaArray<item_t> itemList;
 };
 
 #endif // LEVEL_H
@@ -0,0 +1,498 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QVector>
+#include <cstring>
+#include "levelcache.h"
+
+#define CACHE_MAGIC "TSMC"
+// (entries are only valid on machines with the same byte order)
+#define CACHE_BYTE_ORDER 0x01020304
+
+/*
+  Cache entry layout: a header, followed by each of these sections in order
+  (each one starting on an 8-byte boundary):
+    - the breakable, collision and three visual planes
+    - enemy, enemy type, object, object name and item tables, exactly as
+      they are in a LevelData (except that names are indices into the
+      entry's own symbol table)
+    - the entry's symbol table: every distinct name used by the tables
+    - a blob of UTF-8 strings that the symbol table (and music name) refer to
+  Tables for chunks that weren't decoded when the entry was made are empty
+  (see cacheheader_t::lazyLoaded).
+*/
+struct cachestr_t {
+    uint32_t offset, length;
+};
+
+struct cacheheader_t {
+    char     magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t headerSize;
+    char     hash[16];
+    // the map's size and modification time when the entry was stored
+    // (if these still match, the map isn't hashed again)
+    uint64_t fileSize;
+    int64_t  fileTime;
+
+    uint32_t format;
+    uint32_t width, height;
+    // bitmask of which lazy chunks are in the entry (the rest are decoded
+    // from the map itself, as usual)
+    uint32_t lazyLoaded;
+    uint32_t unknown1, unknown2;
+    cachestr_t music;
+
+    uint32_t numEnemies, numEnemyTypes;
+    uint32_t numObjects, numObjectNames;
+    uint32_t numItems;
+    uint32_t numSymbols;
+    uint32_t stringsSize;
+};
+
+// where each section of an entry starts
+struct cachelayout_t {
+    size_t breakable, collision, visual[3];
+    size_t enemies, enemyTypes, objects, objectNames, items;
+    size_t symbols, strings;
+    size_t total;
+};
+
+static inline size_t align8(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+static cachelayout_t entryLayout(const cacheheader_t &header) {
+    cachelayout_t layout;
+    size_t cells = (size_t)header.width * header.height;
+    size_t pos = align8(sizeof(cacheheader_t));
+
+    layout.breakable = pos;
+    pos = align8(pos + sizeof(int16_t) * cells);
+    layout.collision = pos;
+    pos = align8(pos + sizeof(uint32_t) * cells);
+    for (uint i = 0; i < 3; i++) {
+        layout.visual[i] = pos;
+        pos = align8(pos + sizeof(visual_t) * cells);
+    }
+
+    layout.enemies = pos;
+    pos = align8(pos + sizeof(enemy_t) * header.numEnemies);
+    layout.enemyTypes = pos;
+    pos = align8(pos + sizeof(enemytype_t) * header.numEnemyTypes);
+    layout.objects = pos;
+    pos = align8(pos + sizeof(object_t) * header.numObjects);
+    layout.objectNames = pos;
+    pos = align8(pos + sizeof(symbol_t) * header.numObjectNames);
+    layout.items = pos;
+    pos = align8(pos + sizeof(item_t) * header.numItems);
+
+    layout.symbols = pos;
+    pos = align8(pos + sizeof(cachestr_t) * header.numSymbols);
+    layout.strings = pos;
+    layout.total = pos + header.stringsSize;
+
+    return layout;
+}
+
+static cachestr_t addString(QByteArray &strings, const arenastr_t &str) {
+    cachestr_t ref = {(uint32_t)strings.size(), str.length};
+    strings.append(str.chars, str.length);
+    return ref;
+}
+
+/*
+  Symbols only mean anything within one process, so entries have their own
+  table of names, and the tables in an entry use indices into that instead.
+  (each name is only stored once per entry, however many times it's used)
+*/
+class EntrySymbols {
+public:
+    EntrySymbols(QByteArray &strings) : strings(strings) {}
+
+    symbol_t add(symbol_t symbol) {
+        QHash<symbol_t, symbol_t>::const_iterator i = added.constFind(symbol);
+        if (i != added.constEnd())
+            return i.value();
+
+        QByteArray bytes = SymbolTable::global().bytes(symbol);
+        cachestr_t ref = {(uint32_t)strings.size(), (uint32_t)bytes.size()};
+        strings += bytes;
+
+        symbol_t index = table.size();
+        table.append(ref);
+        added.insert(symbol, index);
+        return index;
+    }
+
+    const QVector<cachestr_t>& entries() const { return table; }
+
+private:
+    QByteArray &strings;
+    QHash<symbol_t, symbol_t> added;
+    QVector<cachestr_t> table;
+};
+
+static inline bool validString(uint32_t size, const cachestr_t &str) {
+    return str.offset <= size && size - str.offset >= str.length;
+}
+
+static arenastr_t getString(Arena &arena, const uchar *strings, uint32_t size, const cachestr_t &str) {
+    if (!validString(size, str))
+        return arena.copyString("", 0);
+
+    return arena.copyString((const char*)strings + str.offset, str.length);
+}
+
+// (an entry's symbol table goes into the process's all at once)
+static QVector<symbol_t> getSymbols(const uchar *strings, uint32_t size,
+                                    const cachestr_t *table, uint count) {
+    QVector<arenastr_t> names(count);
+    for (uint i = 0; i < count; i++) {
+        if (validString(size, table[i])) {
+            names[i].chars = (const char*)strings + table[i].offset;
+            names[i].length = table[i].length;
+        } else {
+            names[i].chars = "";
+            names[i].length = 0;
+        }
+    }
+
+    QVector<symbol_t> symbols(count);
+    SymbolTable::global().internAll(names.constData(), count, symbols.data());
+    return symbols;
+}
+
+static inline symbol_t toSymbol(const QVector<symbol_t> &symbols, symbol_t index) {
+    return index < (uint)symbols.size() ? symbols[index] : NO_SYMBOL;
+}
+
+static inline void copyBlock(void *dst, const void *src, size_t size) {
+    if (size)
+        memcpy(dst, src, size);
+}
+
+LevelCache::LevelCache(const QString &dir, qint64 maxSize)
+    : dir(dir), maxSize(maxSize)
+{}
+
+QString LevelCache::defaultDir() {
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/maps";
+}
+
+QByteArray LevelCache::contentHash(QFile &file) {
+    QCryptographicHash hash(QCryptographicHash::Md5);
+
+    qint64 size = file.size();
+    uchar *data = file.map(0, size);
+    if (data) {
+        hash.addData((const char*)data, size);
+        file.unmap(data);
+    } else {
+        file.seek(0);
+        hash.addData(&file);
+    }
+
+    return hash.result();
+}
+
+/*
+  Entries are named after the map's full path, size and modification time
+*/
+QString LevelCache::entryPath(const QFile &file) const {
+    QFileInfo info(file);
+
+    QByteArray key = info.absoluteFilePath().toUtf8();
+    key += '\0';
+    key += QByteArray::number(info.size());
+    key += '\0';
+    key += QByteArray::number(info.lastModified().toMSecsSinceEpoch());
+
+    return QString("%1/%2.cache").arg(dir)
+            .arg(QString(QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex()));
+}
+
+/*
+  Check that a cache entry's header is from this version of the layout,
+  describes a map that could actually be in the given file, and belongs to
+  that file. The map is only hashed if its size or modification time don't
+  match the ones the entry was stored with.
+*/
+static bool validHeader(const cacheheader_t &header, QFile &file) {
+    if (memcmp(header.magic, CACHE_MAGIC, 4)
+            || header.version != CACHE_VERSION
+            || header.byteOrder != CACHE_BYTE_ORDER
+            || header.headerSize != sizeof(cacheheader_t))
+        return false;
+
+    // (same limits as LevelData::open)
+    QFileInfo info(file);
+    if (header.format <= FormatUnknown || header.format > FormatRTDL
+            || (quint64)header.width * header.height * 2 > (quint64)info.size())
+        return false;
+
+    if (header.fileSize == (quint64)info.size()
+            && header.fileTime == info.lastModified().toMSecsSinceEpoch())
+        return true;
+
+    return !memcmp(header.hash, LevelCache::contentHash(file).constData(), sizeof(header.hash));
+}
+
+/*
+  Load a map from the cache.
+  Returns false if there's no usable entry for it (in which case any
+  outdated entry gets deleted).
+*/
+bool LevelCache::load(QFile &file, LevelData &level) {
+    QFile entry(entryPath(file));
+    if (!entry.open(QFile::ReadOnly))
+        return false;
+
+    qint64 size = entry.size();
+    const uchar *data = 0;
+    if (size >= (qint64)sizeof(cacheheader_t))
+        data = entry.map(0, size);
+    if (!data)
+        return false;
+
+    cacheheader_t header;
+    memcpy(&header, data, sizeof(header));
+
+    cachelayout_t layout = entryLayout(header);
+    if (layout.total != (size_t)size || !validHeader(header, file)) {
+        entry.unmap((uchar*)data);
+        entry.close();
+        entry.remove();
+        return false;
+    }
+
+    level.clear();
+    level.format = (MapFormat)header.format;
+    level.width = header.width;
+    level.height = header.height;
+    level.unknown1 = header.unknown1;
+    level.unknown2 = header.unknown2;
+
+    // anything that isn't in the entry gets decoded from the map later
+    const uint allLazy = (1 << LevelData::NumLazyChunks) - 1;
+    const uint loaded = header.lazyLoaded & allLazy;
+    if (loaded != allLazy && !level.reopen(file)) {
+        level.clear();
+        entry.unmap((uchar*)data);
+        entry.close();
+        entry.remove();
+        return false;
+    }
+
+    const uchar *strings = data + layout.strings;
+    if (loaded & (1 << LevelData::LazyMusic))
+        level.music = getString(level.arena, strings, header.stringsSize, header.music);
+    QVector<symbol_t> symbols = getSymbols(strings, header.stringsSize,
+                                           (const cachestr_t*)(data + layout.symbols),
+                                           header.numSymbols);
+
+    // tile data
+    MapGrid &grid = level.blocks;
+    grid.resize(header.width, header.height, level.arena);
+    copyBlock(grid.breakables().data(), data + layout.breakable, grid.breakables().byteSize());
+    copyBlock(grid.collisions().data(), data + layout.collision, grid.collisions().byteSize());
+    for (uint i = 0; i < 3; i++)
+        copyBlock(grid.visuals(i).data(), data + layout.visual[i], grid.visuals(i).byteSize());
+
+    // entities (copied as-is, then with names pointed back at real symbols)
+    level.enemyList = level.arena.allocArray<enemy_t>(header.numEnemies);
+    copyBlock(level.enemyList.data(), data + layout.enemies, sizeof(enemy_t) * header.numEnemies);
+    for (uint i = 0; i < header.numEnemies; i++)
+        level.enemyList[i].name = toSymbol(symbols, level.enemyList[i].name);
+
+    level.enemyTypeList = level.arena.allocArray<enemytype_t>(header.numEnemyTypes);
+    copyBlock(level.enemyTypeList.data(), data + layout.enemyTypes,
+              sizeof(enemytype_t) * header.numEnemyTypes);
+    for (uint i = 0; i < header.numEnemyTypes; i++) {
+        enemytype_t &type = level.enemyTypeList[i];
+        type.name = toSymbol(symbols, type.name);
+        type.state = toSymbol(symbols, type.state);
+    }
+
+    level.objectList = level.arena.allocArray<object_t>(header.numObjects);
+    copyBlock(level.objectList.data(), data + layout.objects, sizeof(object_t) * header.numObjects);
+
+    level.objectNameList = level.arena.allocArray<symbol_t>(header.numObjectNames);
+    copyBlock(level.objectNameList.data(), data + layout.objectNames,
+              sizeof(symbol_t) * header.numObjectNames);
+    for (uint i = 0; i < header.numObjectNames; i++)
+        level.objectNameList[i] = toSymbol(symbols, level.objectNameList[i]);
+
+    level.itemList = level.arena.allocArray<item_t>(header.numItems);
+    copyBlock(level.itemList.data(), data + layout.items, sizeof(item_t) * header.numItems);
+
+    level.lazyLoaded.storeRelease(loaded);
+
+    entry.unmap((uchar*)data);
+
+    // mark this entry as recently used
+    entry.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    return true;
+}
+
+/*
+  Build a cache entry for a map that was just opened, from whatever has
+  been decoded so far (anything that hasn't stays lazy when the entry is
+  loaded). This is just a copy of the level's data, so it's cheap enough
+  to do before the level is handed over; the entry itself is written
+  later by store(), which is the slow part.
+*/
+QByteArray LevelCache::snapshot(QFile &file, const LevelData &level) {
+    cacheheader_t header;
+    const MapGrid &grid = level.blocks;
+    QByteArray strings;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, 4);
+    header.version = CACHE_VERSION;
+    header.byteOrder = CACHE_BYTE_ORDER;
+    header.headerSize = sizeof(cacheheader_t);
+
+    QFileInfo info(file);
+    header.fileSize = info.size();
+    header.fileTime = info.lastModified().toMSecsSinceEpoch();
+
+    header.format = level.format;
+    header.width = grid.width();
+    header.height = grid.height();
+    header.unknown1 = level.unknown1;
+    header.unknown2 = level.unknown2;
+
+    // (only what's already there; this mustn't decode anything)
+    const uint loaded = level.lazyLoaded.loadAcquire();
+    header.lazyLoaded = loaded;
+    ArenaArray<enemy_t> levelEnemies;
+    ArenaArray<enemytype_t> levelTypes;
+    ArenaArray<object_t> levelObjects;
+    ArenaArray<symbol_t> levelNames;
+    ArenaArray<item_t> levelItems;
+    if (loaded & (1 << LevelData::LazyEnemies))
+        levelEnemies = level.enemyList;
+    if (loaded & (1 << LevelData::LazyEnemyTypes))
+        levelTypes = level.enemyTypeList;
+    if (loaded & (1 << LevelData::LazyObjects)) {
+        levelObjects = level.objectList;
+        levelNames = level.objectNameList;
+    }
+    if (loaded & (1 << LevelData::LazyItems))
+        levelItems = level.itemList;
+
+    if (loaded & (1 << LevelData::LazyMusic))
+        header.music = addString(strings, level.music);
+    EntrySymbols symbols(strings);
+
+    QVector<enemy_t> enemies(levelEnemies.size());
+    for (int i = 0; i < enemies.size(); i++) {
+        enemies[i] = levelEnemies[i];
+        enemies[i].name = symbols.add(enemies[i].name);
+    }
+
+    QVector<enemytype_t> types(levelTypes.size());
+    for (int i = 0; i < types.size(); i++) {
+        types[i].name = symbols.add(levelTypes[i].name);
+        types[i].state = symbols.add(levelTypes[i].state);
+    }
+
+    QVector<symbol_t> names(levelNames.size());
+    for (int i = 0; i < names.size(); i++)
+        names[i] = symbols.add(levelNames[i]);
+
+    const QVector<cachestr_t> &table = symbols.entries();
+
+    header.numEnemies = enemies.size();
+    header.numEnemyTypes = types.size();
+    header.numObjects = levelObjects.size();
+    header.numObjectNames = names.size();
+    header.numItems = levelItems.size();
+    header.numSymbols = table.size();
+    header.stringsSize = strings.size();
+
+    cachelayout_t layout = entryLayout(header);
+    if (layout.total > 0x7FFFFFFF)
+        return QByteArray();
+
+    QByteArray entry((int)layout.total, 0);
+    char *out = entry.data();
+
+    memcpy(out, &header, sizeof(header));
+    copyBlock(out + layout.breakable, grid.breakables().data(), grid.breakables().byteSize());
+    copyBlock(out + layout.collision, grid.collisions().data(), grid.collisions().byteSize());
+    for (uint i = 0; i < 3; i++)
+        copyBlock(out + layout.visual[i], grid.visuals(i).data(), grid.visuals(i).byteSize());
+
+    copyBlock(out + layout.enemies, enemies.constData(), sizeof(enemy_t) * enemies.size());
+    copyBlock(out + layout.enemyTypes, types.constData(), sizeof(enemytype_t) * types.size());
+    copyBlock(out + layout.objects, levelObjects.constData(), sizeof(object_t) * levelObjects.size());
+    copyBlock(out + layout.objectNames, names.constData(), sizeof(symbol_t) * names.size());
+    copyBlock(out + layout.items, levelItems.constData(), sizeof(item_t) * levelItems.size());
+    copyBlock(out + layout.symbols, table.constData(), sizeof(cachestr_t) * table.size());
+    copyBlock(out + layout.strings, strings.constData(), strings.size());
+
+    return entry;
+}
+
+/*
+  Save an entry made by snapshot() to the cache (and make room for it if
+  needed). This hashes the whole map, so it belongs on a background thread.
+  Nothing is stored if the map has changed since the snapshot was taken.
+*/
+bool LevelCache::store(QFile &file, QByteArray entry) {
+    cacheheader_t header;
+    if ((size_t)entry.size() < sizeof(header))
+        return false;
+    memcpy(&header, entry.constData(), sizeof(header));
+
+    QFileInfo info(file);
+    if (header.fileSize != (quint64)info.size()
+            || header.fileTime != info.lastModified().toMSecsSinceEpoch())
+        return false;
+
+    QByteArray hash = contentHash(file);
+    if (hash.size() != sizeof(header.hash) || !QDir().mkpath(dir))
+        return false;
+
+    memcpy(header.hash, hash.constData(), sizeof(header.hash));
+    memcpy(entry.data(), &header, sizeof(header));
+
+    // (written to a temp file first, so other threads/processes never see
+    //  a half-written entry)
+    QSaveFile save(entryPath(file));
+    if (!save.open(QIODevice::WriteOnly)
+            || save.write(entry) != entry.size()
+            || !save.commit())
+        return false;
+
+    trim();
+    return true;
+}
+
+void LevelCache::trim() {
+    // oldest entries first
+    QFileInfoList entries = QDir(dir).entryInfoList(QStringList() << "*.cache", QDir::Files,
+                                                    QDir::Time | QDir::Reversed);
+
+    qint64 total = 0;
+    foreach (const QFileInfo &info, entries)
+        total += info.size();
+
+    for (int i = 0; i < entries.size() && total > maxSize; i++) {
+        if (QFile::remove(entries[i].absoluteFilePath()))
+            total -= entries[i].size();
+    }
+}
@@ -0,0 +1,60 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef LEVELCACHE_H
+#define LEVELCACHE_H
+
+#include <QByteArray>
+#include <QString>
+
+#include "level.h"
+
+class QFile;
+
+// bump this whenever the layout of cache entries (or LevelData) changes
+#define CACHE_VERSION 4
+// default limit on the total size of the cache directory
+#define CACHE_MAX_SIZE (256 << 20)
+
+/*
+  On-disk cache of decoded maps.
+
+  Each entry is a snapshot of a LevelData in native byte order (its grid,
+  plus whichever other chunks had been decoded), laid out so that loading
+  it is one map() and a handful of block copies instead of a full XBIN
+  decode. Entries are keyed by the map's path, size and mtime,
+  and also store the map's size, mtime and a hash of its contents. The
+  hash only has to match on load if the size or mtime don't (so a cache
+  hit never has to read the whole map).
+  Entries from other versions of the layout are thrown out, and the least
+  recently used ones are deleted once the cache grows past its size limit.
+*/
+class LevelCache {
+public:
+    explicit LevelCache(const QString &dir = defaultDir(),
+                        qint64 maxSize = CACHE_MAX_SIZE);
+
+    // hash of a map's contents (what entries are checked against)
+    static QByteArray contentHash(QFile&);
+
+    bool load(QFile&, LevelData&);
+    // (storing a map is split in two, so that the slow part doesn't have
+    //  to hold on to the level; see LevelLoader)
+    static QByteArray snapshot(QFile&, const LevelData&);
+    bool store(QFile&, QByteArray entry);
+
+    // delete least recently used entries until the cache fits its size limit
+    void trim();
+
+    static QString defaultDir();
+
+private:
+    QString entryPath(const QFile&) const;
+
+    QString dir;
+    qint64 maxSize;
+};
+
+#endif // LEVELCACHE_H
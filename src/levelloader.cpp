@@ -0,0 +1,100 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QRunnable>
+#include <QThreadPool>
+#include "levelcache.h"
+#include "levelloader.h"
+
+/*
+  Writes the cache entry for a map that was just opened, once the map
+  itself has been handed over. The entry was already copied out of the
+  level by LevelCache::snapshot, so this only has to hash the map and
+  write the entry out, none of which holds up the open.
+*/
+class CacheStoreTask : public QRunnable {
+public:
+    CacheStoreTask(const QString &path, const QByteArray &entry)
+        : path(path), entry(entry) {}
+
+    void run() {
+        QFile file(path);
+        if (file.open(QFile::ReadOnly))
+            LevelCache().store(file, entry);
+    }
+
+private:
+    QString path;
+    QByteArray entry;
+};
+
+LevelLoader::LevelLoader(const QString &fileName, QObject *parent)
+    : QThread(parent),
+      path(fileName),
+      level(0),
+      canceled(0)
+{}
+
+LevelLoader::~LevelLoader() {
+    cancel();
+    wait();
+    delete level;
+}
+
+/*
+  Hand the loaded map over to the caller (only valid once the thread
+  has finished)
+*/
+LevelData* LevelLoader::takeLevel() {
+    LevelData *result = level;
+    level = 0;
+    return result;
+}
+
+void LevelLoader::cancel() {
+    canceled.storeRelease(1);
+}
+
+bool LevelLoader::isCanceled() const {
+    return canceled.loadAcquire();
+}
+
+void LevelLoader::chunkLoaded(uint done, uint total) {
+    // (called from whichever thread decoded the chunk)
+    emit progress(done, total);
+}
+
+void LevelLoader::run() {
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly)) {
+        errorString = tr("Unable to open file.");
+        return;
+    }
+
+    LevelCache cache;
+    LevelData *newLevel = new LevelData;
+
+    // reopening a map we've seen before?
+    if (cache.load(file, *newLevel)) {
+        level = newLevel;
+        emit progress(1, 1);
+        return;
+    }
+
+    if (newLevel->open(file, this)) {
+        level = newLevel;
+        // (cache it for next time without making this time wait for that)
+        if (!isCanceled()) {
+            QByteArray entry = LevelCache::snapshot(file, *newLevel);
+            if (!entry.isEmpty())
+                QThreadPool::globalInstance()->start(new CacheStoreTask(path, entry));
+        }
+    } else {
+        errorString = QCoreApplication::translate("LevelData", newLevel->errorString());
+        delete newLevel;
+    }
+}
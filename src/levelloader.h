@@ -0,0 +1,54 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef LEVELLOADER_H
+#define LEVELLOADER_H
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QString>
+
+#include "level.h"
+
+/*
+  Opens a map on its own thread into a brand new LevelData, so that the UI
+  doesn't lock up while big maps are loading.
+  Once finished() is emitted, the result can be taken with takeLevel()
+  (or, if loading failed or was canceled, error() says why).
+  Maps that weren't already in the cache are stored in it afterwards, on
+  the global thread pool.
+*/
+class LevelLoader : public QThread, public LoadProgress {
+    Q_OBJECT
+
+public:
+    explicit LevelLoader(const QString &fileName, QObject *parent = 0);
+    ~LevelLoader();
+
+    const QString& fileName() const { return path; }
+    const QString& error() const { return errorString; }
+
+    LevelData* takeLevel();
+
+    void cancel();
+
+    // LoadProgress
+    void chunkLoaded(uint done, uint total);
+    bool isCanceled() const;
+
+signals:
+    void progress(int done, int total);
+
+protected:
+    void run();
+
+private:
+    QString path;
+    QString errorString;
+    LevelData *level;
+    QAtomicInt canceled;
+};
+
+#endif // LEVELLOADER_H
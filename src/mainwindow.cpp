@@ -8,27 +8,48 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 
+#include <QApplication>
 #include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QTextStream>
 #include <QCloseEvent>
 #include <QMessageBox>
 #include <QFileDialog>
+#include <QInputDialog>
 #include <QDesktopServices>
 #include <QUrl>
+#include <QWheelEvent>
 
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 
 #include "level.h"
+#include "maprenderer.h"
 #include "mapscene.h"
 #include "objectwindow.h"
+#include "texture.h"
 #include "version.h"
 
+// how far the map view can be zoomed in/out, and how much each step zooms
+#define ZOOM_MIN  (1.0 / 64)
+#define ZOOM_MAX  4.0
+#define ZOOM_STEP 1.25
+
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow),
     fileOpen(false),
-    objWin(new ObjectWindow(this, &level)),
-    scene(new MapScene(this, &level))
+    tilesetFormat(TextureETC1),
+    tilesetWidth(256),
+    level(new LevelData),
+    loader(0),
+    objWin(new ObjectWindow(this, level)),
+    exporter(0),
+    exportDialog(0),
+    scene(new MapScene(this, level)),
+    zoom(1.0)
 {
     ui->setupUi(this);
 
@@ -36,6 +57,18 @@ MainWindow::MainWindow(QWidget *parent) :
     // enable mouse tracking for graphics view
     ui->graphicsView->setMouseTracking(true);
     ui->graphicsView->setBackgroundRole(QPalette::Mid);
+    // zoom in/out around the mouse cursor, and catch ctrl+wheel for zooming
+    ui->graphicsView->setTransformationAnchor(QGraphicsView::AnchorUnderMouse);
+    ui->graphicsView->viewport()->installEventFilter(this);
+    // keep the map itself cached, since only the overlays on top of it
+    // change when the mouse moves (see MapScene::updateOverlays)
+    ui->graphicsView->setCacheMode(QGraphicsView::CacheBackground);
+
+#ifdef TRISTAR_NO_PROFILER
+    // (built without the render profiler)
+    ui->action_Render_Profile->setVisible(false);
+    ui->action_Save_Render_Profile->setVisible(false);
+#endif
 
     // remove margins around map view and other stuff
     this->centralWidget()->layout()->setContentsMargins(0,0,0,0);
@@ -48,9 +81,17 @@ MainWindow::MainWindow(QWidget *parent) :
 
 MainWindow::~MainWindow()
 {
+    // stop anything that's still loading before the window goes away
+    cancelLoading();
+    foreach (LevelLoader *oldLoader, findChildren<LevelLoader*>())
+        delete oldLoader;
+    // (an export still has the level, so it has to stop first)
+    cancelExport();
+
     delete ui;
     delete objWin;
     delete scene;
+    delete level;
 }
 
 void MainWindow::setupSignals() {
@@ -59,6 +100,10 @@ void MainWindow::setupSignals() {
             this, SLOT(openFile()));
     connect(ui->action_Close, SIGNAL(triggered()),
             this, SLOT(closeFile()));
+    connect(ui->action_Load_Tileset, SIGNAL(triggered()),
+            this, SLOT(loadTileset()));
+    connect(ui->action_Export_Image, SIGNAL(triggered()),
+            this, SLOT(exportImage()));
 
     connect(ui->action_Exit, SIGNAL(triggered()),
             this, SLOT(close()));
@@ -80,6 +125,16 @@ void MainWindow::setupSignals() {
             scene, SLOT(setShowObjects(bool)));
     connect(ui->action_Items, SIGNAL(triggered(bool)),
             scene, SLOT(setShowItems(bool)));
+    connect(ui->action_Zoom_In, SIGNAL(triggered()),
+            this, SLOT(zoomIn()));
+    connect(ui->action_Zoom_Out, SIGNAL(triggered()),
+            this, SLOT(zoomOut()));
+    connect(ui->action_Render_Profile, SIGNAL(triggered(bool)),
+            scene, SLOT(setProfiling(bool)));
+    connect(ui->action_Save_Render_Profile, SIGNAL(triggered()),
+            this, SLOT(saveRenderProfile()));
+    connect(ui->action_Actual_Size, SIGNAL(triggered()),
+            this, SLOT(resetZoom()));
 
     // help menu
     connect(ui->action_About, SIGNAL(triggered()),
@@ -89,6 +144,11 @@ void MainWindow::setupSignals() {
     // receive status bar messages from scene
     connect(scene, SIGNAL(statusMessage(QString)),
             ui->statusBar, SLOT(showMessage(QString)));
+    // show entities picked on the map in the object window
+    connect(scene, SIGNAL(entitiesSelected()),
+            this, SLOT(entitiesSelected()));
+    connect(scene, SIGNAL(entityActivated(int,int)),
+            objWin, SLOT(showEntity(int,int)));
 }
 
 void MainWindow::setupActions() {
@@ -131,6 +191,7 @@ void MainWindow::setOpenFileActions(bool val) {
 void MainWindow::setEditActions(bool val) {
     setUndoRedoActions(val);
     ui->action_Close       ->setEnabled(val);
+    ui->action_Export_Image->setEnabled(val);
     ui->action_Open        ->setEnabled(val);
 }
 
@@ -175,43 +236,285 @@ void MainWindow::openFile() {
                                  tr("Map data (*.dat);;All files (*.*)"));
 
     if (!newFileName.isNull() && !closeFile()) {
+        // only the most recent request counts
+        cancelLoading();
+
         status(tr("Opening file %1").arg(newFileName));
 
-        // open file
-        QFile file(newFileName);
-        if (file.open(QFile::ReadOnly)) {
-            // check magic
-            file.seek(0);
-            if (file.read(4) != "XBIN") {
-                QMessageBox::information(this,
-                                         "Open Map",
-                                         "File is not a valid map.",
-                                         QMessageBox::Ok);
-
-                file.close();
-                return;
-            }
-
-            if (level.open(file)) {
-                fileName = newFileName;
-                fileOpen = true;
-                setOpenFileActions(true);
-
-                objWin->update();
-                objWin->show();
-            }
-
-            file.close();
-        } else {
-            QMessageBox::information(this,
-                                     "Open Map",
-                                     "Unable to open file.",
-                                     QMessageBox::Ok);
+        // load the map in the background and swap it in when it's done
+        // (see loadFinished)
+        loader = new LevelLoader(newFileName, this);
+        connect(loader, SIGNAL(progress(int,int)),
+                this, SLOT(loadProgress(int,int)));
+        connect(loader, SIGNAL(finished()),
+                this, SLOT(loadFinished()));
+        loader->start();
+    }
+}
+
+/*
+  Read the animated tiles for a tileset from a text file, one per line:
+    speed <NTSC frames per animation frame>
+    <tile>: <frame> <frame> ...
+  (anything after a # is ignored)
+*/
+static void readTileAnimations(const QString &path, QVector<tileanim_t> &anims, int &speed) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return;
+
+    QTextStream stream(&file);
+    while (!stream.atEnd()) {
+        QString line = stream.readLine().section('#', 0, 0).trimmed();
+        if (line.isEmpty())
+            continue;
+
+        if (line.startsWith("speed")) {
+            speed = line.mid(5).trimmed().toInt();
+            continue;
+        }
+
+        bool ok;
+        tileanim_t anim;
+        anim.tile = line.section(':', 0, 0).toInt(&ok);
+        if (!ok)
+            continue;
+        foreach (const QString &frame, line.section(':', 1).split(' ', QString::SkipEmptyParts)) {
+            int tile = frame.toInt(&ok);
+            if (ok)
+                anim.frames.append(tile);
         }
+        if (!anim.frames.isEmpty())
+            anims.append(anim);
+    }
+}
+
+/*
+  Load a raw tileset texture and decode it for the map view.
+  There's no header to read the format and size from, so ask for them
+  (the height is however much the rest of the file covers).
+*/
+void MainWindow::loadTileset() {
+    QString newName = QFileDialog::getOpenFileName(this,
+                                 tr("Load Tileset"),
+                                 tilesetName,
+                                 tr("All files (*.*)"));
+    if (newName.isNull()) return;
+
+    QStringList formats;
+    for (int i = 0; i < NumTextureFormats; i++)
+        formats << textureFormatName((TextureFormat)i);
+
+    bool ok;
+    QString formatName = QInputDialog::getItem(this, tr("Load Tileset"),
+                                               tr("Texture format:"),
+                                               formats, tilesetFormat, false, &ok);
+    if (!ok) return;
+    int width = QInputDialog::getInt(this, tr("Load Tileset"),
+                                     tr("Texture width (pixels):"),
+                                     tilesetWidth, 8, 8192, 8, &ok);
+    if (!ok) return;
+
+    QFile file(newName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        QMessageBox::warning(this, tr("Load Tileset"),
+                             tr("Unable to open %1:\n%2")
+                             .arg(newName).arg(file.errorString()));
+        return;
+    }
+    QByteArray data = file.readAll();
+
+    TextureFormat format = (TextureFormat)formats.indexOf(formatName);
+    uint height = textureHeight(format, width, data.size());
+
+    QImage image(width, height, QImage::Format_ARGB32);
+    if (!height
+        || !decodeTexture((uint32_t*)image.bits(), image.bytesPerLine() / 4,
+                          data.constData(), data.size(), width, height, format)) {
+        QMessageBox::warning(this, tr("Load Tileset"),
+                             tr("%1 is too small for a %2 texture %3 pixels wide.")
+                             .arg(newName).arg(formatName).arg(width));
+        return;
+    }
+
+    tilesetName   = newName;
+    tilesetFormat = format;
+    tilesetWidth  = width;
+
+    scene->setTileset(image);
+
+    // animated tiles are listed in a text file next to the tileset, if any
+    QVector<tileanim_t> anims;
+    int speed = 0;
+    readTileAnimations(newName + ".anim", anims, speed);
+    scene->setTileAnimations(anims, speed);
+    status(tr("Loaded tileset %1 (%2x%3, %4)")
+           .arg(newName).arg(width).arg(height).arg(formatName));
+}
+
+/*
+  Write the whole map out to a PNG at actual size, with whatever layers and
+  entities are being shown (and the tileset, if there is one).
+  This only ever has one band of the map in memory, however big the map is,
+  and happens on its own thread (see MapExporter).
+*/
+void MainWindow::exportImage() {
+    if (!fileOpen || exporter) return;
+
+    QFileInfo info(fileName);
+    QString path = QFileDialog::getSaveFileName(this,
+                                 tr("Export Map Image"),
+                                 info.dir().filePath(info.completeBaseName() + ".png"),
+                                 tr("PNG images (*.png)"));
+    if (path.isNull()) return;
+
+    status(tr("Exporting %1").arg(path));
+
+    exporter = new MapExporter(level, scene->layerMask(), scene->entityMask(),
+                               scene->tileset(), path, this);
+    connect(exporter, SIGNAL(progress(int,int)),
+            this, SLOT(exportProgress(int,int)));
+    connect(exporter, SIGNAL(finished()),
+            this, SLOT(exportFinished()));
+
+    // (window modal, so that the map can't be closed or replaced from under it)
+    exportDialog = new QProgressDialog(tr("Exporting %1...").arg(info.fileName()),
+                                       tr("Cancel"), 0, 0, this);
+    exportDialog->setWindowTitle(tr("Export Map Image"));
+    exportDialog->setWindowModality(Qt::WindowModal);
+    exportDialog->setMinimumDuration(0);
+    connect(exportDialog, SIGNAL(canceled()),
+            exporter, SLOT(cancel()));
+
+    exporter->start();
+}
+
+void MainWindow::exportProgress(int done, int total) {
+    if (sender() != exporter || !exportDialog) return;
+
+    exportDialog->setMaximum(total);
+    exportDialog->setValue(done);
+}
+
+void MainWindow::exportFinished() {
+    if (sender() != exporter) return;
+
+    MapExporter *done = exporter;
+    exporter = 0;
+    exportDialog->deleteLater();
+    exportDialog = 0;
+    done->deleteLater();
+
+    if (done->succeeded()) {
+        status(tr("Exported %1 (%2x%3)")
+               .arg(done->fileName()).arg(done->width()).arg(done->height()));
+    } else if (done->isCanceled()) {
+        status(tr("Export canceled"));
+    } else {
+        status("");
+        QMessageBox::warning(this, tr("Export Map Image"),
+                             tr("Unable to export %1:\n%2")
+                             .arg(done->fileName()).arg(done->error()));
+    }
+}
+
+/*
+  Stop exporting (if anything is being exported), and wait for the
+  exporter to let go of the level
+*/
+void MainWindow::cancelExport() {
+    if (!exporter) return;
+
+    delete exporter;
+    exporter = 0;
+    delete exportDialog;
+    exportDialog = 0;
+}
 
-        scene->refresh();
-        updateTitle();
+/*
+  Dump every frame the render profiler has collected to a CSV file
+*/
+void MainWindow::saveRenderProfile() {
+    QString path = QFileDialog::getSaveFileName(this,
+                                 tr("Save Render Profile"),
+                                 QString(),
+                                 tr("CSV files (*.csv)"));
+    if (path.isNull()) return;
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)
+        || !scene->renderProfiler().writeCsv(&file)
+        || !file.commit()) {
+        QMessageBox::warning(this, tr("Save Render Profile"),
+                             tr("Unable to save %1:\n%2")
+                             .arg(path).arg(file.errorString()));
+        return;
+    }
+
+    status(tr("Saved %1 frames to %2")
+           .arg(scene->renderProfiler().samples().size()).arg(path));
+}
+
+/*
+  Cancel whatever map is currently being loaded (if any).
+  The loader finishes in the background and deletes itself afterwards.
+*/
+void MainWindow::cancelLoading() {
+    if (loader) {
+        loader->cancel();
+        loader = 0;
+    }
+}
+
+void MainWindow::loadProgress(int done, int total) {
+    // ignore stragglers from canceled loads
+    if (sender() != loader) return;
+
+    status(tr("Opening file %1 (%2/%3 chunks)")
+           .arg(loader->fileName()).arg(done).arg(total));
+}
+
+void MainWindow::loadFinished() {
+    LevelLoader *done = qobject_cast<LevelLoader*>(sender());
+    if (!done) return;
+
+    done->deleteLater();
+    // was this load canceled or replaced by a newer one?
+    if (done != loader) return;
+    loader = 0;
+
+    LevelData *newLevel = done->takeLevel();
+    if (newLevel) {
+        // swap in the new map all at once
+        foreach (const QString &warning, newLevel->warnings())
+            qDebug("%s", qPrintable(warning));
+
+        // (the old map can't go away while it's being exported)
+        cancelExport();
+
+        LevelData *oldLevel = level;
+        level = newLevel;
+        scene->setLevel(level);
+        objWin->setLevel(level);
+        delete oldLevel;
+
+        fileName = done->fileName();
+        fileOpen = true;
+        setOpenFileActions(true);
+
+        objWin->update();
+        objWin->show();
+        status(tr("Opened file %1").arg(fileName));
+    } else {
+        status("");
+        QMessageBox::information(this,
+                                 "Open Map",
+                                 done->error(),
+                                 QMessageBox::Ok);
     }
+
+    scene->refresh();
+    updateTitle();
 }
 
 /*
@@ -222,6 +525,8 @@ void MainWindow::openFile() {
      0: file closed successfully (or was already closed)
 */
 int MainWindow::closeFile() {
+    cancelLoading();
+
     if (!fileOpen)
         return 0;
 
@@ -238,6 +543,47 @@ int MainWindow::closeFile() {
     return 0;
 }
 
+/*
+  View menu zoom slots
+*/
+void MainWindow::zoomIn() {
+    setZoom(zoom * ZOOM_STEP);
+}
+
+void MainWindow::zoomOut() {
+    setZoom(zoom / ZOOM_STEP);
+}
+
+void MainWindow::resetZoom() {
+    setZoom(1.0);
+}
+
+void MainWindow::setZoom(qreal newZoom) {
+    zoom = qBound(ZOOM_MIN, newZoom, ZOOM_MAX);
+    ui->graphicsView->setTransform(QTransform::fromScale(zoom, zoom));
+    ui->graphicsView->resetCachedContent();
+    status(tr("Zoom: %1%").arg(qRound(zoom * 100)));
+}
+
+/*
+  ctrl+mouse wheel over the map view zooms in/out
+  (one step per notch of the wheel)
+*/
+bool MainWindow::eventFilter(QObject *object, QEvent *event) {
+    if (object == ui->graphicsView->viewport() && event->type() == QEvent::Wheel) {
+        QWheelEvent *wheel = static_cast<QWheelEvent*>(event);
+        if (wheel->modifiers() & Qt::ControlModifier) {
+            setZoom(zoom * pow(ZOOM_STEP, wheel->angleDelta().y() / 120.0));
+            return true;
+        }
+    }
+    return QMainWindow::eventFilter(object, event);
+}
+
+void MainWindow::entitiesSelected() {
+    objWin->selectEntities(scene->selectedEntities());
+}
+
 /*
   Help menu item slots
 */
@@ -10,8 +10,11 @@
 
 #include <QtWidgets/QMessageBox>
 #include <QtWidgets/QLabel>
+#include <QtWidgets/QProgressDialog>
 
 #include "level.h"
+#include "levelloader.h"
+#include "mapexporter.h"
 #include "mapscene.h"
 #include "objectwindow.h"
 
@@ -31,6 +34,23 @@ protected slots:
     // file menu
     void openFile();
     int  closeFile();
+    void loadTileset();
+    void exportImage();
+    void exportProgress(int done, int total);
+    void exportFinished();
+
+    // map loading
+    void loadProgress(int done, int total);
+    void loadFinished();
+
+    // view menu
+    void zoomIn();
+    void zoomOut();
+    void resetZoom();
+    void saveRenderProfile();
+
+    // entities picked on the map
+    void entitiesSelected();
 
     // help menu
     void showAbout();
@@ -45,6 +65,7 @@ protected slots:
 
 protected:
     void closeEvent(QCloseEvent *);
+    bool eventFilter(QObject *, QEvent *);
 
 private:
     Ui::MainWindow *ui;
@@ -53,18 +74,32 @@ private:
     QString fileName;
     bool    fileOpen;
 
-    // The level data
-    LevelData level;
+    // The last tileset texture loaded (and how it was decoded)
+    QString tilesetName;
+    int     tilesetFormat;
+    int     tilesetWidth;
+
+    // The level data (and whatever is currently loading a new one)
+    LevelData *level;
+    LevelLoader *loader;
     ObjectWindow *objWin;
 
+    // the map image being exported (if any), and its progress dialog
+    MapExporter *exporter;
+    QProgressDialog *exportDialog;
+
     // renderin stuff
     MapScene *scene;
+    qreal zoom;
 
     // various funcs
     void setupSignals();
     void setupActions();
     void updateTitle();
     void setLevel(uint);
+    void cancelLoading();
+    void cancelExport();
+    void setZoom(qreal);
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,60 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#include <QSaveFile>
+#include "mapexporter.h"
+#include "maprenderer.h"
+
+MapExporter::MapExporter(const LevelData *level, uint layers, uint entityKinds,
+                         const QImage &tileset, const QString &fileName, QObject *parent)
+    : QThread(parent),
+      level(level),
+      layers(layers),
+      entityKinds(entityKinds),
+      tileset(tileset),
+      path(fileName),
+      ok(false),
+      imageWidth(0),
+      imageHeight(0),
+      canceled(0)
+{}
+
+MapExporter::~MapExporter() {
+    cancel();
+    wait();
+}
+
+void MapExporter::cancel() {
+    canceled.storeRelease(1);
+}
+
+bool MapExporter::isCanceled() const {
+    return canceled.loadAcquire();
+}
+
+void MapExporter::chunkLoaded(uint done, uint total) {
+    emit progress(done, total);
+}
+
+void MapExporter::run() {
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        errorString = file.errorString();
+        return;
+    }
+
+    // (this loads any entities being shown that haven't been yet, so it
+    //  happens here instead of on the UI thread, too)
+    MapRenderer renderer(*level, layers, entityKinds, tileset);
+    imageWidth = renderer.width();
+    imageHeight = renderer.height();
+
+    ok = renderer.writePng(&file, &errorString, this);
+    if (ok && !file.commit()) {
+        ok = false;
+        errorString = file.errorString();
+    }
+    // (a canceled export leaves nothing behind, since it's never committed)
+}
@@ -0,0 +1,62 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef MAPEXPORTER_H
+#define MAPEXPORTER_H
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QImage>
+#include <QString>
+
+#include "level.h"
+
+/*
+  Exports a whole map to a PNG on its own thread (see MapRenderer), so that
+  the UI doesn't lock up while big maps are being written out.
+  The level has to stay around until finished() is emitted; after that,
+  succeeded() and error() say how it went.
+*/
+class MapExporter : public QThread, public LoadProgress {
+    Q_OBJECT
+
+public:
+    MapExporter(const LevelData *level, uint layers, uint entityKinds,
+                const QImage &tileset, const QString &fileName, QObject *parent = 0);
+    ~MapExporter();
+
+    const QString& fileName() const { return path; }
+    bool succeeded() const { return ok; }
+    const QString& error() const { return errorString; }
+    // size of the exported image (in pixels)
+    uint width() const { return imageWidth; }
+    uint height() const { return imageHeight; }
+
+    // LoadProgress (each band of the map counts as a chunk)
+    void chunkLoaded(uint done, uint total);
+    bool isCanceled() const;
+
+public slots:
+    void cancel();
+
+signals:
+    void progress(int done, int total);
+
+protected:
+    void run();
+
+private:
+    const LevelData *level;
+    uint layers, entityKinds;
+    QImage tileset;
+
+    QString path;
+    QString errorString;
+    bool ok;
+    uint imageWidth, imageHeight;
+    QAtomicInt canceled;
+};
+
+#endif // MAPEXPORTER_H
@@ -0,0 +1,159 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef MAPGRID_H
+#define MAPGRID_H
+
+#include <QtGlobal>
+#include <cstdint>
+#include <cstring>
+
+#include "arena.h"
+
+// alignment of each layer plane (one cache line)
+#define PLANE_ALIGN 64
+
+// one cell of a visual layer
+struct visual_t {
+    int16_t  first;
+    uint16_t second;
+};
+
+// flip flags in the second half of a visual tile
+// (best guess; nothing else in that word is known yet)
+#define VISUAL_FLIP_H 0x4000
+#define VISUAL_FLIP_V 0x8000
+
+/*
+  One layer of the map grid, stored as a single contiguous, aligned block
+  of width*height values in row-major order.
+  The block comes from the level's arena, so it's freed along with
+  everything else the level owns.
+*/
+template <typename type> class LayerPlane {
+public:
+    LayerPlane() : cells(0), w(0), h(0) {}
+
+    void resize(uint width, uint height, Arena &arena) {
+        clear();
+
+        if (width && height) {
+            cells = arena.allocArray<type>(width * height, PLANE_ALIGN).data();
+            w = width;
+            h = height;
+        }
+    }
+
+    // (doesn't free anything; that's up to the arena)
+    void clear() {
+        cells = 0;
+        w = h = 0;
+    }
+
+    void fill(type value) {
+        for (size_t i = 0; i < count(); i++)
+            cells[i] = value;
+    }
+
+    type* row(uint y)             { return cells + (y * w); }
+    const type* row(uint y) const { return cells + (y * w); }
+
+    type& at(uint x, uint y)             { return cells[y * w + x]; }
+    const type& at(uint x, uint y) const { return cells[y * w + x]; }
+
+    uint width() const  { return w; }
+    uint height() const { return h; }
+
+    type* data()             { return cells; }
+    const type* data() const { return cells; }
+
+    // number of cells
+    size_t count() const { return (size_t)w * h; }
+    size_t byteSize() const { return sizeof(type) * count(); }
+
+private:
+    Q_DISABLE_COPY(LayerPlane)
+
+    type *cells;
+    uint w, h;
+};
+
+/*
+  The tile data of a map: one plane each for breakable blocks, collision
+  and the three visual layers, all with the same dimensions.
+  Everything that reads or writes tile data goes through this (the loader
+  writes whole rows, the renderer reads one layer at a time).
+  The planes themselves are allocated from an Arena, which has to outlive
+  them (or at least be reset only after clear() is called).
+*/
+class MapGrid {
+public:
+    MapGrid() : w(0), h(0) {}
+
+    void resize(uint width, uint height, Arena &arena) {
+        w = width;
+        h = height;
+        breakablePlane.resize(width, height, arena);
+        collisionPlane.resize(width, height, arena);
+        for (uint i = 0; i < 3; i++)
+            visualPlanes[i].resize(width, height, arena);
+    }
+
+    void clear() {
+        w = h = 0;
+        breakablePlane.clear();
+        collisionPlane.clear();
+        for (uint i = 0; i < 3; i++)
+            visualPlanes[i].clear();
+    }
+
+    uint width() const  { return w; }
+    uint height() const { return h; }
+    bool isEmpty() const { return !w || !h; }
+
+    bool contains(int x, int y) const {
+        return x >= 0 && y >= 0 && (uint)x < w && (uint)y < h;
+    }
+
+    // per-cell access
+    int16_t breakable(uint x, uint y) const { return breakablePlane.at(x, y); }
+    uint32_t collision(uint x, uint y) const { return collisionPlane.at(x, y); }
+    const visual_t& visual(uint layer, uint x, uint y) const {
+        return visualPlanes[layer].at(x, y);
+    }
+
+    // per-row access (for bulk loading and drawing)
+    int16_t* breakableRow(uint y)             { return breakablePlane.row(y); }
+    const int16_t* breakableRow(uint y) const { return breakablePlane.row(y); }
+    uint32_t* collisionRow(uint y)             { return collisionPlane.row(y); }
+    const uint32_t* collisionRow(uint y) const { return collisionPlane.row(y); }
+    visual_t* visualRow(uint layer, uint y)             { return visualPlanes[layer].row(y); }
+    const visual_t* visualRow(uint layer, uint y) const { return visualPlanes[layer].row(y); }
+
+    // whole-plane access
+    LayerPlane<int16_t>& breakables()  { return breakablePlane; }
+    LayerPlane<uint32_t>& collisions() { return collisionPlane; }
+    LayerPlane<visual_t>& visuals(uint layer) { return visualPlanes[layer]; }
+    const LayerPlane<int16_t>& breakables() const  { return breakablePlane; }
+    const LayerPlane<uint32_t>& collisions() const { return collisionPlane; }
+    const LayerPlane<visual_t>& visuals(uint layer) const { return visualPlanes[layer]; }
+
+    size_t byteSize() const {
+        return breakablePlane.byteSize() + collisionPlane.byteSize()
+             + visualPlanes[0].byteSize() + visualPlanes[1].byteSize()
+             + visualPlanes[2].byteSize();
+    }
+
+private:
+    Q_DISABLE_COPY(MapGrid)
+
+    uint w, h;
+
+    LayerPlane<int16_t>  breakablePlane;
+    LayerPlane<uint32_t> collisionPlane;
+    LayerPlane<visual_t> visualPlanes[3];
+};
+
+#endif // MAPGRID_H
@@ -0,0 +1,311 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#include <QFontMetrics>
+#include <QHash>
+#include <QPainter>
+#include "compositor.h"
+#include "maprenderer.h"
+#include "pngwriter.h"
+
+// how many rows of tiles are rendered (and written out) at once when exporting
+#define EXPORT_BAND_ROWS 16
+
+/*
+  Color lookup tables for the layer images.
+  Tile colors only depend on the low 6 bits of a tile's value (hue is
+  20 * value mod 256), so a tile with value v is stored as (v & 63) + 1,
+  with 0 meaning "nothing here".
+*/
+#define PALETTE_SIZE 65
+
+static inline uchar paletteIndex(int value) {
+    return (value & 63) + 1;
+}
+
+static QVector<QRgb> makePalette(int saturation, int alpha) {
+    QVector<QRgb> palette(PALETTE_SIZE);
+    palette[0] = qRgba(0, 0, 0, 0);
+    for (int i = 1; i < PALETTE_SIZE; i++)
+        palette[i] = QColor::fromHsv(20 * (i - 1) & 0xFF, saturation, 255, alpha).rgba();
+    return palette;
+}
+
+const QVector<QRgb>& layerPalette(uint layer) {
+    // (visual layers 0 and 2 are drawn translucent)
+    static const QVector<QRgb> palettes[] = {
+        makePalette(192, 128),
+        makePalette(192, 255),
+        makePalette(192, 128),
+        makePalette(255, 255),
+        makePalette(255, 255)
+    };
+    return palettes[layer];
+}
+
+// (same as above, but premultiplied and padded out for the compositor)
+struct compositepalettes_t {
+    uint32_t colors[NumLayers][COMPOSITE_PALETTE_SIZE];
+
+    compositepalettes_t() {
+        for (uint i = 0; i < NumLayers; i++) {
+            const QVector<QRgb> &palette = layerPalette(i);
+            for (uint j = 0; j < COMPOSITE_PALETTE_SIZE; j++)
+                colors[i][j] = j < PALETTE_SIZE ? qPremultiply(palette[j]) : 0;
+        }
+    }
+};
+
+static const uint32_t* compositePalette(uint layer) {
+    // (built the first time any thread asks for it)
+    static const compositepalettes_t palettes;
+    return palettes.colors[layer];
+}
+
+QImage layerImage(const MapGrid &grid, uint layer) {
+    QImage image(grid.width(), grid.height(), QImage::Format_Indexed8);
+    image.setColorTable(layerPalette(layer));
+
+    for (uint y = 0; y < grid.height(); y++) {
+        uchar *pixels = image.scanLine(y);
+
+        if (layer < 3) {
+            const visual_t *row = grid.visualRow(layer, y);
+            for (uint x = 0; x < grid.width(); x++)
+                pixels[x] = row[x].first >= 0 ? paletteIndex(row[x].first) : 0;
+        } else if (layer == 3) {
+            const uint32_t *collision = grid.collisionRow(y);
+            for (uint x = 0; x < grid.width(); x++)
+                pixels[x] = collision[x] > 0 ? paletteIndex(collision[x] - 1) : 0;
+        } else {
+            const int16_t *breakable = grid.breakableRow(y);
+            for (uint x = 0; x < grid.width(); x++)
+                pixels[x] = breakable[x] > -1 ? paletteIndex(breakable[x]) : 0;
+        }
+    }
+
+    return image;
+}
+
+void compositeTiles(uint32_t *dst, size_t dstStride, const QImage *layerImages, uint mask,
+                    uint left, uint top, uint width, uint height) {
+    static const uint order[NumLayers] = {2, 1, 0, 3, 4};
+    complayer_t layers[NumLayers];
+    uint numLayers = 0;
+    for (uint i = 0; i < NumLayers; i++) {
+        uint layer = order[i];
+        if (mask & (1 << layer)) {
+            const QImage &image = layerImages[layer];
+            layers[numLayers].indices = image.constScanLine(top) + left;
+            layers[numLayers].stride = image.bytesPerLine();
+            layers[numLayers].palette = compositePalette(layer);
+            numLayers++;
+        }
+    }
+
+    compositeLayers(dst, dstStride, width, height, layers, numLayers);
+}
+
+const QFont& MapRenderer::labelFont() {
+    static const QFont font("Segoe UI", 10, QFont::Bold);
+    return font;
+}
+
+const QColor& MapRenderer::entityColor(uint kind) {
+    // (indexed by EntityKind)
+    static const QColor colors[NumEntityKinds] = {
+        QColor(255, 192, 192, 192),
+        QColor(0, 192, 224, 192),
+        QColor(255, 255, 255, 192)
+    };
+    return colors[kind];
+}
+
+/*
+  (just above and to the right of the entity itself)
+*/
+QRectF MapRenderer::labelRect(const QPointF &pos, const QSizeF &size) {
+    return QRectF(pos.x(), pos.y() - size.height() + MAP_TEXT_PAD_V,
+                  size.width() + 2 * MAP_TEXT_PAD_H,
+                  size.height() + MAP_TEXT_PAD_V);
+}
+
+MapRenderer::MapRenderer(const LevelData &level, uint layers, uint entityKinds,
+                         const QImage &tileset)
+    : level(level), layers(layers), entityKinds(entityKinds),
+      tileset(tileset),
+      atlasColumns(tileset.width() / TILE_SIZE),
+      atlasTiles(atlasColumns * (tileset.height() / TILE_SIZE))
+{
+    for (uint i = 0; i < NumLayers; i++) {
+        if (layers & (1 << i))
+            layerImages[i] = layerImage(level.blocks, i);
+    }
+
+    if (entityKinds) {
+        // (only the kinds being drawn get loaded)
+        entities.build(level, entityKinds);
+
+        // (for finding the labels that reach into each band)
+        uint counts[NumEntityKinds] = {
+            (entityKinds & (1 << EntityObject)) ? (uint)level.objects().size() : 0,
+            (entityKinds & (1 << EntityItem))   ? (uint)level.items().size()   : 0,
+            (entityKinds & (1 << EntityEnemy))  ? (uint)level.enemies().size() : 0
+        };
+
+        QFontMetrics metrics(labelFont());
+        QHash<symbol_t, bool> names;
+        for (uint kind = 0; kind < NumEntityKinds; kind++) {
+            if (!(entityKinds & (1 << kind)))
+                continue;
+
+            for (uint i = 0; i < counts[kind]; i++) {
+                entityref_t ref = {(EntityKind)kind, i};
+                symbol_t name = EntityIndex::name(level, ref);
+                if (!names.contains(name)) {
+                    names.insert(name, true);
+                    maxLabelSize = maxLabelSize.expandedTo(metrics.boundingRect(symbolName(name)).size());
+                }
+            }
+        }
+    }
+}
+
+uint MapRenderer::width() const {
+    return level.blocks.width() * TILE_SIZE;
+}
+
+uint MapRenderer::height() const {
+    return level.blocks.height() * TILE_SIZE;
+}
+
+void MapRenderer::renderRows(QImage &image, uint top, uint rows) const {
+    const MapGrid &grid = level.blocks;
+    image.fill(Qt::transparent);
+
+    QPainter painter(&image);
+    painter.translate(0, -(qreal)top * TILE_SIZE);
+
+    // the tileset stands in for the visual layers' colors, if there is one
+    uint shown = layers & ALL_LAYERS;
+    if (atlasTiles) {
+        drawTiles(painter, top, rows);
+        shown &= ~VISUAL_LAYERS;
+    }
+
+    // everything else is composited at one pixel per tile and scaled up
+    if (shown) {
+        QImage tiles(grid.width(), rows, QImage::Format_ARGB32_Premultiplied);
+        compositeTiles((uint32_t*)tiles.bits(), tiles.bytesPerLine() / 4, layerImages, shown,
+                       0, top, grid.width(), rows);
+        painter.drawImage(QRectF(0, top * TILE_SIZE, grid.width() * TILE_SIZE, rows * TILE_SIZE),
+                          tiles);
+    }
+
+    drawLabels(painter, top, rows);
+}
+
+/*
+  Draw the visual layers from the tileset, back to front
+  (tiles past the end of the tileset are left out, same as the map view)
+*/
+void MapRenderer::drawTiles(QPainter &painter, uint top, uint rows) const {
+    const MapGrid &grid = level.blocks;
+    const qreal half = TILE_SIZE / 2.0;
+
+    for (int i = 2; i >= 0; i--) {
+        if (!(layers & (LayerVisual0 << i)))
+            continue;
+
+        for (uint y = top; y < top + rows; y++) {
+            const visual_t *row = grid.visualRow(i, y);
+            for (uint x = 0; x < grid.width(); x++) {
+                const visual_t &tile = row[x];
+                if (tile.first < 0 || (uint)tile.first >= atlasTiles)
+                    continue;
+
+                QRectF source((tile.first % atlasColumns) * TILE_SIZE,
+                              (tile.first / atlasColumns) * TILE_SIZE,
+                              TILE_SIZE, TILE_SIZE);
+
+                if (tile.second & (VISUAL_FLIP_H | VISUAL_FLIP_V)) {
+                    painter.save();
+                    painter.translate(x * TILE_SIZE + half, y * TILE_SIZE + half);
+                    painter.scale(tile.second & VISUAL_FLIP_H ? -1 : 1,
+                                  tile.second & VISUAL_FLIP_V ? -1 : 1);
+                    painter.drawImage(QRectF(-half, -half, TILE_SIZE, TILE_SIZE), tileset, source);
+                    painter.restore();
+                } else {
+                    painter.drawImage(QPointF(x * TILE_SIZE, y * TILE_SIZE), tileset, source);
+                }
+            }
+        }
+    }
+}
+
+/*
+  Draw the names of objects, then items, then enemies (same as the map view),
+  for every entity whose label reaches into some rows of the map
+*/
+void MapRenderer::drawLabels(QPainter &painter, uint top, uint rows) const {
+    if (!entityKinds)
+        return;
+
+    // (labels go up and to the right of their entities; this is in tiles)
+    qreal labelWidth  = (qreal)(maxLabelSize.width() + 2 * MAP_TEXT_PAD_H) / TILE_SIZE;
+    qreal labelHeight = (qreal)maxLabelSize.height() / TILE_SIZE;
+    QRectF area(-labelWidth, top, level.blocks.width() + labelWidth, rows + labelHeight);
+
+    QFontMetrics metrics(labelFont());
+    painter.setFont(labelFont());
+    painter.setPen(Qt::black);
+
+    for (uint kind = 0; kind < NumEntityKinds; kind++) {
+        if (!(entityKinds & (1 << kind)))
+            continue;
+
+        foreach (const entityref_t &ref, entities.inRect(area, 1 << kind)) {
+            QString name = symbolName(EntityIndex::name(level, ref));
+            QRectF labelArea = labelRect(EntityIndex::position(level, ref) * TILE_SIZE,
+                                         metrics.boundingRect(name).size());
+
+            painter.fillRect(labelArea, entityColor(kind));
+            painter.drawText(labelArea.adjusted(0, MAP_TEXT_PAD_V, 0, 0),
+                             Qt::AlignLeft | Qt::AlignTop | Qt::TextDontClip, name);
+        }
+    }
+}
+
+bool MapRenderer::writePng(QIODevice *device, QString *error, LoadProgress *progress) const {
+    const uint rowsHigh = level.blocks.height();
+    PngWriter png(device);
+    bool ok = png.begin(width(), height());
+
+    QImage band(width(), EXPORT_BAND_ROWS * TILE_SIZE, QImage::Format_ARGB32_Premultiplied);
+    for (uint top = 0; ok && top < rowsHigh; top += EXPORT_BAND_ROWS) {
+        uint rows = qMin<uint>(EXPORT_BAND_ROWS, rowsHigh - top);
+        renderRows(band, top, rows);
+
+        // (PNGs aren't premultiplied)
+        QImage pixels = band.convertToFormat(QImage::Format_ARGB32);
+        ok = png.writeRows((const uint32_t*)pixels.constBits(), pixels.bytesPerLine() / 4,
+                           rows * TILE_SIZE);
+
+        if (progress) {
+            const uint bands = (rowsHigh + EXPORT_BAND_ROWS - 1) / EXPORT_BAND_ROWS;
+            progress->chunkLoaded(top / EXPORT_BAND_ROWS + 1, bands);
+            if (progress->isCanceled()) {
+                if (error)
+                    *error = "Canceled.";
+                return false;
+            }
+        }
+    }
+
+    ok = ok && png.end();
+    if (!ok && error)
+        *error = png.errorString();
+    return ok;
+}
@@ -0,0 +1,102 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef MAPRENDERER_H
+#define MAPRENDERER_H
+
+#include <QColor>
+#include <QFont>
+#include <QImage>
+#include <QIODevice>
+#include <QRectF>
+#include <QString>
+#include <QVector>
+
+#include "entityindex.h"
+#include "level.h"
+
+class QPainter;
+
+// size of a tile in the scene / in exported images (in pixels)
+#define TILE_SIZE 16
+#define TILE_SHIFT 4
+
+// padding around entity labels
+#define MAP_TEXT_PAD_H 4
+#define MAP_TEXT_PAD_V 0
+
+// tile layers that can be drawn, as bits of a layer mask
+enum MapLayer {
+    LayerVisual0   = 1 << 0,
+    LayerVisual1   = 1 << 1,
+    LayerVisual2   = 1 << 2,
+    LayerCollision = 1 << 3,
+    LayerBreakable = 1 << 4,
+    NumLayers      = 5
+};
+
+#define ALL_LAYERS ((1 << NumLayers) - 1)
+#define VISUAL_LAYERS (LayerVisual0 | LayerVisual1 | LayerVisual2)
+
+// color table for one layer (indexed by bit number in a layer mask)
+const QVector<QRgb>& layerPalette(uint layer);
+// one layer of a map as an indexed image (using layerPalette) with one pixel per tile
+QImage layerImage(const MapGrid &grid, uint layer);
+/*
+  Draw the layers in a mask over part of the map (from images made by
+  layerImage), at one pixel per tile, into premultiplied ARGB32 pixels.
+  Layers go back to front: visual 2-0, then collision, then breakables.
+*/
+void compositeTiles(uint32_t *dst, size_t dstStride, const QImage *layerImages, uint mask,
+                    uint left, uint top, uint width, uint height);
+
+/*
+  Renders a whole map at actual size (the same as the map view with no zoom),
+  a band of tile rows at a time, so that a map can be written out as an
+  image without ever having all of it in memory at once.
+
+  Each renderer only reads from the level, so several of them can run on
+  different threads at once (one per map).
+*/
+class MapRenderer {
+public:
+    MapRenderer(const LevelData &level, uint layers = ALL_LAYERS,
+                uint entityKinds = ALL_ENTITIES, const QImage &tileset = QImage());
+
+    // size of the whole map (in pixels)
+    uint width() const;
+    uint height() const;
+
+    // draw some rows of tiles (and every label that reaches into them) into an
+    // image as wide as the map and at least rows * TILE_SIZE pixels tall
+    void renderRows(QImage &image, uint top, uint rows) const;
+
+    // render the whole map into a PNG, one band of rows at a time
+    // (progress is reported once per band, and canceling stops after the
+    //  current one)
+    bool writePng(QIODevice *device, QString *error = 0, LoadProgress *progress = 0) const;
+
+    // how entity labels look (on the map view, too)
+    static const QFont& labelFont();
+    static const QColor& entityColor(uint kind);
+    // where an entity at pos (in pixels) has its label of a given size drawn
+    static QRectF labelRect(const QPointF &pos, const QSizeF &size);
+
+private:
+    const LevelData &level;
+    uint layers, entityKinds;
+
+    QImage tileset;
+    uint atlasColumns, atlasTiles;
+
+    QImage layerImages[NumLayers];
+    EntityIndex entities;
+    QSize maxLabelSize;
+
+    void drawTiles(QPainter &painter, uint top, uint rows) const;
+    void drawLabels(QPainter &painter, uint top, uint rows) const;
+};
+
+#endif // MAPRENDERER_H
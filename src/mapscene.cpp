@@ -8,32 +8,58 @@
 #include <QTimer>
 #include <QFontMetrics>
 #include <QGraphicsView>
+#include <QHash>
+#include <QRunnable>
 #include <algorithm>
 #include <stdexcept>
 #include <cstdlib>
+#include <cmath>
 #include <list>
 #include "level.h"
 #include "mainwindow.h"
 #include "mapscene.h"
 
-#define MAP_TEXT_PAD_H 4
-#define MAP_TEXT_PAD_V 0
-
-// move to a graphics-related source file eventually idk
-#define TILE_SIZE 16
-
-const QFont MapScene::infoFont("Segoe UI", 10, QFont::Bold);
-const QFontMetrics MapScene::infoFontMetrics(MapScene::infoFont);
-
-const QColor MapScene::enemyColor(255, 255, 255, 192);
-const QColor MapScene::objectColor(255, 192, 192, 192);
-const QColor MapScene::itemColor(0, 192, 224, 192);
+// size of each pre-rendered chunk of the map (in tiles)
+#define CHUNK_TILES 32
+#define CHUNK_SIZE (CHUNK_TILES * TILE_SIZE)
+// how much memory to spend on pre-rendered chunks (in KB)
+#define CHUNK_CACHE_SIZE (128 << 10)
+// how far ahead of the view to render chunks while scrolling (in chunks)
+#define PREFETCH_CHUNKS 2
+// below this zoom level, entities are drawn as markers instead of labels
+#define LABEL_MIN_ZOOM 0.5
+// size of the screen area each entity marker covers (in pixels)
+#define MARKER_SIZE 24
+// how close a double-click has to be to an entity to pick it (in tiles)
+#define PICK_DISTANCE 1.0
+// most zoomed out level of detail that draws tiles from the tileset
+// (instead of one color per tile) when there is one
+#define ATLAS_MAX_LOD 2
+// render thread priorities
+#define PRIORITY_VISIBLE  1
+#define PRIORITY_PREFETCH 0
+// where the profiling overlay goes in each view, and how often it's redrawn
+// when nothing else is being drawn (in msec)
+#define HUD_MARGIN 8
+#define HUD_REFRESH 500
 
 const QColor MapScene::infoBackColor(255, 192, 192, 128);
 
 const QColor MapScene::selectionColor(255, 192, 192, 192);
 const QColor MapScene::selectionBorder(255, 192, 192, 255);
 
+const QColor MapScene::placeholderColor(128, 128, 128, 64);
+
+/*
+  Pick the coarsest level of detail that still has at least one pixel for
+  each pixel on the screen at the given scale
+*/
+static uint detailLevel(qreal scale, uint numLods) {
+    if (scale >= 1.0 || scale <= 0.0)
+        return 0;
+    return qMin((uint)floor(log2(1.0 / scale)), numLods - 1);
+}
+
 /*
   Overridden constructor which inits some scene info
  */
@@ -42,21 +68,46 @@ MapScene::MapScene(QObject *parent, LevelData *currentLevel)
 
       tileX(-1), tileY(-1),
       selLength(0), selWidth(0), selecting(false),
+      bandSelecting(false),
       stack(this),
       level(currentLevel),
       tilesetPixmap(256*TILE_SIZE, TILE_SIZE),
+      atlasColumns(0), atlasTiles(0),
       animFrame(0), animTimer(this),
+      hudTimer(this),
       showCollision(true),
       showVisual({true, true, true}),
       showBreakable(true),
       showObjects(true),
       showItems(true),
-      showEnemies(true)
+      showEnemies(true),
+      chunkCache(CHUNK_CACHE_SIZE),
+      renderGeneration(0)
 {
+    for (uint lod = 0; lod < NumLods; lod++)
+        chunksWide[lod] = chunksHigh[lod] = 0;
+
+    // (edits change the map itself, so the views' cached backgrounds have
+    //  to be thrown out too; nothing else should need to repaint everything)
     QObject::connect(this, SIGNAL(edited()),
-                     this, SLOT(update()));
+                     this, SLOT(invalidate()));
     QObject::connect(&animTimer, SIGNAL(timeout()),
                      this, SLOT(animate()));
+    QObject::connect(&hudTimer, SIGNAL(timeout()),
+                     this, SLOT(refreshHud()));
+}
+
+MapScene::~MapScene() {
+    // (so no render threads are left pointing at the scene)
+    renderPool.clear();
+    renderPool.waitForDone();
+}
+
+/*
+  Change which level is being displayed (call refresh() afterwards)
+*/
+void MapScene::setLevel(LevelData *newLevel) {
+    level = newLevel;
 }
 
 /*
@@ -69,6 +120,9 @@ void MapScene::refresh() {
 
     // reset the scene
     clear();
+    buildLayers();
+    buildEntities();
+    buildAnimations();
 
     // if level is null , minimize the scene and return
     if (!level) {
@@ -84,7 +138,8 @@ void MapScene::refresh() {
     //setAnimSpeed(level->header.animSpeed);
     refreshPixmap();
 
-    update();
+    // (throw out the views' cached backgrounds too)
+    invalidate();
 }
 
 void MapScene::setAnimSpeed(int speed) {
@@ -97,6 +152,7 @@ void MapScene::setAnimSpeed(int speed) {
         animFrame = 0;
         animTimer.stop();
         refreshPixmap();
+        invalidate(sceneRect(), QGraphicsScene::BackgroundLayer);
     }
 }
 
@@ -104,13 +160,126 @@ const QPixmap* MapScene::getPixmap() const {
     return &this->tilesetPixmap;
 }
 
+/*
+  Use a decoded tileset texture (see texture.h) for the visual layers.
+  Tile n is at column (n % tiles per row), row (n / tiles per row).
+*/
+void MapScene::setTileset(const QImage &image) {
+    tilesetImage = image;
+    tilesetPixmap = QPixmap::fromImage(tilesetImage);
+    atlasColumns = tilesetImage.width() / TILE_SIZE;
+    atlasTiles = atlasColumns * (tilesetImage.height() / TILE_SIZE);
+
+    refreshPixmap();
+    invalidate();
+}
+
+const QImage& MapScene::tileset() const {
+    return tilesetImage;
+}
+
+/*
+  Set up which tiles are animated, and how fast (in frames per animation
+  frame, or 0 to stop animating)
+*/
+void MapScene::setTileAnimations(const QVector<tileanim_t> &anims, int speed) {
+    tileAnims = anims;
+    animFrame = 0;
+    buildAnimations();
+    setAnimSpeed(speed);
+
+    refreshPixmap();
+    invalidate();
+}
+
+/*
+  Find everywhere each animated tile is used on the map, as one rectangle
+  per chunk around the cells that use it
+*/
+void MapScene::buildAnimations() {
+    animAreas.clear();
+    animAreas.resize(tileAnims.size());
+
+    if (!level || level->blocks.isEmpty() || tileAnims.isEmpty())
+        return;
+
+    // which animation (if any) each tile number uses
+    QHash<int, int> animated;
+    for (int i = 0; i < tileAnims.size(); i++)
+        animated.insert(tileAnims[i].tile, i);
+
+    const MapGrid &grid = level->blocks;
+    for (uint cy = 0; cy < chunksHigh[0]; cy++) {
+        for (uint cx = 0; cx < chunksWide[0]; cx++) {
+            if (!(chunkLayers[0][cy * chunksWide[0] + cx]
+                  & (LayerVisual0 | LayerVisual1 | LayerVisual2)))
+                continue;
+
+            QHash<int, QRect> found;
+            uint right  = qMin((cx + 1) * CHUNK_TILES, grid.width());
+            uint bottom = qMin((cy + 1) * CHUNK_TILES, grid.height());
+            for (uint i = 0; i < 3; i++) {
+                for (uint y = cy * CHUNK_TILES; y < bottom; y++) {
+                    const visual_t *row = grid.visualRow(i, y);
+                    for (uint x = cx * CHUNK_TILES; x < right; x++) {
+                        QHash<int, int>::const_iterator anim = animated.constFind(row[x].first);
+                        if (anim != animated.constEnd())
+                            found[anim.value()] |= QRect(x, y, 1, 1);
+                    }
+                }
+            }
+
+            for (QHash<int, QRect>::const_iterator i = found.constBegin();
+                 i != found.constEnd(); i++) {
+                const QRect &cells = i.value();
+                animAreas[i.key()].append(QRectF(cells.x() * TILE_SIZE, cells.y() * TILE_SIZE,
+                                                 cells.width() * TILE_SIZE,
+                                                 cells.height() * TILE_SIZE));
+            }
+        }
+    }
+}
+
+/*
+  Point every tile back at itself in the tileset, except for animated
+  tiles, which point at whichever frame they're on
+*/
 void MapScene::refreshPixmap() {
-    // ...
+    atlasEntries.resize(atlasTiles);
+    for (uint i = 0; i < atlasTiles; i++)
+        atlasEntries[i] = i;
+
+    foreach (const tileanim_t &anim, tileAnims) {
+        if (anim.tile >= 0 && (uint)anim.tile < atlasTiles && !anim.frames.isEmpty())
+            atlasEntries[anim.tile] = anim.frames[animFrame % anim.frames.size()];
+    }
 }
 
 // advance to next animation frame
 void MapScene::animate() {
-    // ...
+    animFrame++;
+
+    // the tileset is only drawn when zoomed in far enough (see drawsTiles),
+    // so don't bother redrawing anything when no view is
+    bool shown = false;
+    foreach (QGraphicsView *view, views())
+        shown |= drawsTiles(detailLevel(view->transform().m11(), NumLods));
+
+    for (int i = 0; i < tileAnims.size(); i++) {
+        const tileanim_t &anim = tileAnims[i];
+        if (anim.tile < 0 || (uint)anim.tile >= atlasTiles || anim.frames.isEmpty())
+            continue;
+
+        int frame = anim.frames[animFrame % anim.frames.size()];
+        if (atlasEntries[anim.tile] == frame)
+            continue;
+
+        atlasEntries[anim.tile] = frame;
+        if (shown) {
+            foreach (const QRectF &area, animAreas[i])
+                invalidate(area, QGraphicsScene::BackgroundLayer);
+        }
+    }
 }
 
 /*
@@ -121,36 +290,67 @@ void MapScene::mousePressEvent(QGraphicsSceneMouseEvent *event) {
     // (or if the click is outside of the scene)
     if (!isActive() || !sceneRect().contains(event->scenePos())) return;
 
+    overlays_t before = overlays();
+
+    // shift+left button: start selecting entities
     // left button: start or continue selection
     // right button: cancel selection
-    if (event->buttons() & Qt::LeftButton) {
+    if ((event->buttons() & Qt::LeftButton)
+            && (event->modifiers() & Qt::ShiftModifier)) {
+        bandSelecting = true;
+        bandRect = QRectF(event->scenePos(), QSizeF());
+        event->accept();
+        updateOverlays(before);
+
+    } else if (event->buttons() & Qt::LeftButton) {
         beginSelection(event);
         event->accept();
+        updateOverlays(before);
 
     } else if (event->buttons() & Qt::RightButton) {
         cancelSelection();
         event->accept();
     }
-    update();
 }
 
 /*
-  Handle when a double-click occurs (used to start the tile edit window)
+  Handle when a double-click occurs
+  (on an entity: select it and show its info; otherwise used to start the
+   tile edit window)
 */
 void MapScene::mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event) {
     if (!isActive()) return;
 
-    emit doubleClicked();
+    overlays_t before = overlays();
+    entityref_t entity;
+    if (entityAt(event->scenePos(), entity)) {
+        selection.clear();
+        selection.append(entity);
+        emit entitiesSelected();
+        emit entityActivated(entity.kind, entity.index);
+    } else {
+        emit doubleClicked();
+    }
     event->accept();
 
-    update();
+    updateOverlays(before);
 }
 
 /*
   Handle when the left mouse button is released
 */
 void MapScene::mouseReleaseEvent(QGraphicsSceneMouseEvent *event) {
-    if (event->button() == Qt::LeftButton) {
+    overlays_t before = overlays();
+
+    if (event->button() == Qt::LeftButton && bandSelecting) {
+        bandSelecting = false;
+        selection = entitiesIn(bandRect);
+        bandRect = QRectF();
+        emit entitiesSelected();
+        emit statusMessage(QString("Selected %1 entities").arg(selection.size()));
+
+        event->accept();
+    } else if (event->button() == Qt::LeftButton) {
         selecting = false;
 
         // normalize selection dimensions (i.e. handle negative height/width)
@@ -166,7 +366,7 @@ void MapScene::mouseReleaseEvent(QGraphicsSceneMouseEvent *event) {
 
         event->accept();
     }
-    update();
+    updateOverlays(before);
 }
 
 /*
@@ -176,8 +376,13 @@ void MapScene::mouseMoveEvent(QGraphicsSceneMouseEvent *event) {
     // if inactive, don't handle mouse moves
     if (!isActive()) return;
 
+    overlays_t before = overlays();
+
     // behave differently based on left mouse button status
-    if (selecting && event->buttons() & Qt::LeftButton) {
+    if (bandSelecting && event->buttons() & Qt::LeftButton) {
+        // dragging out a rectangle of entities
+        bandRect.setBottomRight(event->scenePos());
+    } else if (selecting && event->buttons() & Qt::LeftButton) {
         // left button down: generate/show selection
         updateSelection(event);
     } else {
@@ -186,7 +391,8 @@ void MapScene::mouseMoveEvent(QGraphicsSceneMouseEvent *event) {
 
     event->accept();
 
-    update();
+    // (only repaint where the hover highlight/selection was and now is)
+    updateOverlays(before);
 }
 
 /*
@@ -357,6 +563,22 @@ void MapScene::updateSelection(QGraphicsSceneMouseEvent *event) {
   Called when the mouse is over the MapScene without the left button held down.
 */
 void MapScene::showTileInfo(QGraphicsSceneMouseEvent *event) {
+    QPointF pos = event->scenePos();
+    int x = floor(pos.x() / TILE_SIZE);
+    int y = floor(pos.y() / TILE_SIZE);
+
+    // ignore invalid mouseover positions
+    if (!level || x < 0 || y < 0 || x >= (int)level->width || y >= (int)level->height)
+        x = y = -1;
+
+    if (x != tileX || y != tileY) {
+        tileX = x;
+        tileY = y;
+
+        // also, pass the mouseover coords to the main window
+        emit mouseOverTile(tileX, tileY);
+    }
+
     /*
     QPointF pos = event->scenePos();
     // if hte mouse is moved onto a different tile, erase the old one
@@ -394,36 +616,51 @@ void MapScene::showTileInfo(QGraphicsSceneMouseEvent *event) {
   Remove the selection pixmap from the scene.
 */
 void MapScene::cancelSelection() {
+    overlays_t before = overlays();
+
     selecting = false;
     selWidth = 0;
     selLength = 0;
     selX = 0;
     selY = 0;
+
+    bandSelecting = false;
+    bandRect = QRectF();
+    if (!selection.isEmpty()) {
+        selection.clear();
+        emit entitiesSelected();
+    }
+
+    updateOverlays(before);
+}
+
+const QVector<entityref_t>& MapScene::selectedEntities() const {
+    return selection;
 }
 
 void MapScene::setShowCollision(bool on) {
     showCollision = on;
-    update();
+    invalidate(sceneRect(), QGraphicsScene::BackgroundLayer);
 }
 
 void MapScene::setShowFGDecor(bool on) {
     showVisual[0] = on;
-    update();
+    invalidate(sceneRect(), QGraphicsScene::BackgroundLayer);
 }
 
 void MapScene::setShowTerrain(bool on) {
     showVisual[1] = on;
-    update();
+    invalidate(sceneRect(), QGraphicsScene::BackgroundLayer);
 }
 
 void MapScene::setShowBGDecor(bool on) {
     showVisual[2] = on;
-    update();
+    invalidate(sceneRect(), QGraphicsScene::BackgroundLayer);
 }
 
 void MapScene::setShowBreakable(bool on) {
     showBreakable = on;
-    update();
+    invalidate(sceneRect(), QGraphicsScene::BackgroundLayer);
 }
 
 void MapScene::setShowObjects(bool on) {
@@ -441,59 +678,613 @@ void MapScene::setShowEnemies(bool on) {
     update();
 }
 
+/*
+  Get the parts of the scene covered by each overlay the mouse can change
+  (tile highlight, tile selection, entity selection) so that they can be
+  repainted by themselves. The views cache the background, so repainting
+  these never redraws any of the map itself.
+*/
+MapScene::overlays_t MapScene::overlays() const {
+    overlays_t areas;
+
+    if (tileX >= 0 && tileY >= 0)
+        areas.hover = QRectF(tileX * TILE_SIZE, tileY * TILE_SIZE, TILE_SIZE, TILE_SIZE);
+
+    if (selWidth != 0 && selLength != 0) {
+        int selLeft = qMin(selX, selX + selWidth + 1);
+        int selTop  = qMin(selY, selY + selLength + 1);
+        areas.tiles = QRectF(selLeft * TILE_SIZE, selTop * TILE_SIZE,
+                             abs(selWidth) * TILE_SIZE, abs(selLength) * TILE_SIZE);
+    }
+
+    if (bandSelecting)
+        areas.band = bandRect.normalized();
+
+    foreach (const entityref_t &ref, selection)
+        areas.entities |= labelRect(ref);
+
+    return areas;
+}
+
+static inline void updateArea(QGraphicsScene *scene, const QRectF &before, const QRectF &after) {
+    if (before == after)
+        return;
+
+    // (a bit extra for the outlines around things)
+    if (!before.isNull())
+        scene->update(before.adjusted(-1, -1, 1, 1));
+    if (!after.isNull())
+        scene->update(after.adjusted(-1, -1, 1, 1));
+}
+
+/*
+  Repaint whichever overlays have changed since overlays() was called
+*/
+void MapScene::updateOverlays(const overlays_t &before) {
+    overlays_t after = overlays();
+
+    updateArea(this, before.hover, after.hover);
+    updateArea(this, before.tiles, after.tiles);
+    updateArea(this, before.band, after.band);
+    updateArea(this, before.entities, after.entities);
+}
+
+/*
+  Get the layers that are currently being shown
+*/
+uint MapScene::layerMask() const {
+    uint mask = 0;
+    if (showVisual[0]) mask |= LayerVisual0;
+    if (showVisual[1]) mask |= LayerVisual1;
+    if (showVisual[2]) mask |= LayerVisual2;
+    if (showCollision) mask |= LayerCollision;
+    if (showBreakable) mask |= LayerBreakable;
+    return mask;
+}
+
+/*
+  Whether the visual layers are drawn straight from the tileset at a given
+  level of detail (any further out than that, there'd be more tiles than
+  pixels on the screen, so they come from the pre-rendered chunks instead)
+*/
+bool MapScene::drawsTiles(uint lod) const {
+    return atlasTiles && lod <= ATLAS_MAX_LOD;
+}
+
+/*
+  Get the layers that come from the pre-rendered chunks at a given level
+  of detail
+*/
+uint MapScene::chunkMask(uint lod) const {
+    uint mask = layerMask();
+    if (drawsTiles(lod))
+        mask &= ~VISUAL_LAYERS;
+    return mask;
+}
+
+/*
+  Convert each layer of the current level to an indexed image, throw out
+  all pre-rendered chunks, and find out which layers each chunk actually
+  has anything in (at every level of detail).
+  Chunks are cached by the layers they actually show, so toggling a layer
+  only misses the cache for chunks that have something in that layer
+  (and toggling it back hits the cache again).
+*/
+void MapScene::buildLayers() {
+    // forget about any chunks that are still waiting to be rendered
+    renderPool.clear();
+    pendingChunks.clear();
+    renderGeneration++;
+    lastVisible = QRectF();
+
+    chunkCache.clear();
+    for (uint lod = 0; lod < NumLods; lod++) {
+        chunkLayers[lod].clear();
+        chunksWide[lod] = chunksHigh[lod] = 0;
+    }
+    for (uint i = 0; i < NumLayers; i++)
+        layerImages[i] = QImage();
+
+    if (!level || level->blocks.isEmpty())
+        return;
+
+    const MapGrid &grid = level->blocks;
+    chunksWide[0] = (grid.width() + CHUNK_TILES - 1) / CHUNK_TILES;
+    chunksHigh[0] = (grid.height() + CHUNK_TILES - 1) / CHUNK_TILES;
+    chunkLayers[0].fill(0, chunksWide[0] * chunksHigh[0]);
+
+    for (uint i = 0; i < NumLayers; i++) {
+        layerImages[i] = layerImage(grid, i);
+
+        for (uint y = 0; y < grid.height(); y++) {
+            const uchar *pixels = layerImages[i].constScanLine(y);
+            uchar *layers = chunkLayers[0].data() + (y / CHUNK_TILES) * chunksWide[0];
+            for (uint x = 0; x < grid.width(); x++) {
+                if (pixels[x])
+                    layers[x / CHUNK_TILES] |= 1 << i;
+            }
+        }
+    }
+
+    // each coarser level of detail just combines 2x2 chunks of the one before it
+    for (uint lod = 1; lod < NumLods; lod++) {
+        chunksWide[lod] = (chunksWide[lod - 1] + 1) / 2;
+        chunksHigh[lod] = (chunksHigh[lod - 1] + 1) / 2;
+        chunkLayers[lod].fill(0, chunksWide[lod] * chunksHigh[lod]);
+
+        for (uint cy = 0; cy < chunksHigh[lod - 1]; cy++) {
+            const uchar *finer = chunkLayers[lod - 1].constData() + cy * chunksWide[lod - 1];
+            uchar *layers = chunkLayers[lod].data() + (cy / 2) * chunksWide[lod];
+            for (uint cx = 0; cx < chunksWide[lod - 1]; cx++)
+                layers[cx / 2] |= finer[cx];
+        }
+    }
+}
+
+static inline quint64 chunkKey(uint cx, uint cy, uint lod, uint mask) {
+    return ((quint64)cy << 40) | ((quint64)cx << 12) | (lod << 8) | mask;
+}
+
+/*
+  Average each factor x factor box of pixels in a strip of composited tiles
+  down to a single pixel (premultiplied, so transparent tiles just thin out
+  the color around them)
+*/
+static void reduceRow(uint32_t *dst, const uint32_t *src,
+                      uint width, uint rows, uint factor) {
+    for (uint x = 0; x < width; x += factor) {
+        uint cols = qMin(factor, width - x);
+        uint sum[4] = {0, 0, 0, 0};
+
+        for (uint y = 0; y < rows; y++) {
+            const uint32_t *pixels = src + y * width + x;
+            for (uint i = 0; i < cols; i++)
+                for (uint c = 0; c < 4; c++)
+                    sum[c] += (pixels[i] >> (8 * c)) & 0xFF;
+        }
+
+        uint count = rows * cols;
+        uint32_t pixel = 0;
+        for (uint c = 0; c < 4; c++)
+            pixel |= ((sum[c] + count / 2) / count) << (8 * c);
+        dst[x / factor] = pixel;
+    }
+}
+
+/*
+  Renders one chunk of the map with the given layers drawn on it, on one of
+  the scene's render threads, and hands it back to the scene when done.
+  Each task holds on to its own (shallow) copies of the layer images, so it
+  doesn't matter if the scene rebuilds them in the meantime.
+
+  Chunks at level of detail n cover (CHUNK_TILES << n) tiles across, with
+  tiles drawn (TILE_SIZE >> n) pixels across; once that gets below one pixel
+  per tile, each pixel is the average of a box of tiles instead.
+*/
+class ChunkTask : public QRunnable {
+public:
+    ChunkTask(MapScene *scene, uint cx, uint cy, uint lod, uint mask)
+        : scene(scene), generation(scene->renderGeneration),
+          cx(cx), cy(cy), lod(lod), mask(mask) {
+        for (uint i = 0; i < NumLayers; i++)
+            layerImages[i] = scene->layerImages[i];
+    }
+
+    void run() {
+        const QImage &first = layerImages[0];
+        uint span   = CHUNK_TILES << lod;
+        uint left   = cx * span;
+        uint top    = cy * span;
+        uint width  = qMin<uint>(left + span, first.width()) - left;
+        uint height = qMin<uint>(top + span, first.height()) - top;
+
+        QImage image;
+        if (lod <= TILE_SHIFT) {
+            // composite at one pixel per tile, then scale that up to
+            // full size in one go
+            image = QImage(width, height, QImage::Format_ARGB32_Premultiplied);
+            compositeTiles((uint32_t*)image.bits(), image.bytesPerLine() / 4,
+                           layerImages, mask, left, top, width, height);
+
+            uint tileSize = TILE_SIZE >> lod;
+            if (tileSize > 1)
+                image = image.scaled(width * tileSize, height * tileSize);
+        } else {
+            // composite a strip of tiles at a time and shrink each one
+            // down to a single row
+            uint factor = 1 << (lod - TILE_SHIFT);
+            image = QImage((width + factor - 1) / factor, (height + factor - 1) / factor,
+                           QImage::Format_ARGB32_Premultiplied);
+
+            QVector<uint32_t> strip(width * factor);
+            for (int y = 0; y < image.height(); y++) {
+                uint rows = qMin(factor, height - y * factor);
+                compositeTiles(strip.data(), width, layerImages, mask,
+                               left, top + y * factor, width, rows);
+                reduceRow((uint32_t*)image.scanLine(y), strip.constData(), width, rows, factor);
+            }
+        }
+
+        // (turning it into a pixmap has to wait for the GUI thread)
+        QMetaObject::invokeMethod(scene, "chunkRendered", Qt::QueuedConnection,
+                                  Q_ARG(uint, generation), Q_ARG(uint, cx), Q_ARG(uint, cy),
+                                  Q_ARG(uint, lod), Q_ARG(uint, mask), Q_ARG(QImage, image));
+    }
+
+private:
+    MapScene *scene;
+    uint generation;
+    uint cx, cy, lod, mask;
+    QImage layerImages[NumLayers];
+};
+
+/*
+  Get the range of chunks (at a given level of detail) that cover part
+  of the scene
+*/
+void MapScene::chunkRange(const QRectF &rect, uint lod,
+                          uint &left, uint &top, uint &right, uint &bottom) const {
+    qreal size = CHUNK_SIZE << lod;
+    left   = rect.left() / size;
+    top    = rect.top() / size;
+    right  = qMin((uint)ceil(rect.right() / size), chunksWide[lod]);
+    bottom = qMin((uint)ceil(rect.bottom() / size), chunksHigh[lod]);
+}
+
+/*
+  Queue up a chunk to be rendered, unless it already is
+  (visible chunks get a higher priority than prefetched ones)
+*/
+void MapScene::requestChunk(uint cx, uint cy, uint lod, uint mask, int priority) {
+    quint64 key = chunkKey(cx, cy, lod, mask);
+    if (pendingChunks.contains(key) || chunkCache.contains(key))
+        return;
+
+    pendingChunks.insert(key);
+    renderPool.start(new ChunkTask(this, cx, cy, lod, mask), priority);
+}
+
+/*
+  Put a freshly rendered chunk in the cache and redraw where it goes
+*/
+void MapScene::chunkRendered(uint generation, uint cx, uint cy, uint lod, uint mask, QImage image) {
+    if (generation != renderGeneration)
+        return;
+
+    quint64 key = chunkKey(cx, cy, lod, mask);
+    pendingChunks.remove(key);
+
+    QPixmap *pixmap = new QPixmap(QPixmap::fromImage(image));
+    chunkCache.insert(key, pixmap, pixmap->width() * pixmap->height() * 4 / 1024);
+
+    uint size = CHUNK_SIZE << lod;
+    invalidate(QRectF(cx * size, cy * size, pixmap->width() << lod, pixmap->height() << lod),
+               QGraphicsScene::BackgroundLayer);
+}
+
+/*
+  Get the part of the scene that's visible in any of its views
+*/
+QRectF MapScene::visibleRect() const {
+    QRectF visible;
+    foreach (QGraphicsView *view, views())
+        visible |= view->mapToScene(view->viewport()->rect()).boundingRect();
+    return visible & sceneRect();
+}
+
+/*
+  Start rendering the chunks just past the edge of the view, in whichever
+  direction it's being scrolled
+*/
+void MapScene::prefetchChunks(const QRectF &visible, uint lod) {
+    QPointF delta = visible.center() - lastVisible.center();
+    bool moved = !lastVisible.isNull();
+    lastVisible = visible;
+
+    if (!moved || visible.isNull() || delta.isNull())
+        return;
+
+    const qreal ahead = PREFETCH_CHUNKS * (CHUNK_SIZE << lod);
+    QRectF rect = visible.adjusted(delta.x() < 0 ? -ahead : 0, delta.y() < 0 ? -ahead : 0,
+                                   delta.x() > 0 ?  ahead : 0, delta.y() > 0 ?  ahead : 0);
+    rect &= sceneRect();
+
+    uint left, top, right, bottom;
+    chunkRange(rect, lod, left, top, right, bottom);
+
+    uint shown = chunkMask(lod);
+    for (uint cy = top; cy < bottom; cy++) {
+        for (uint cx = left; cx < right; cx++) {
+            uint mask = shown & chunkLayers[lod][cy * chunksWide[lod] + cx];
+            if (mask)
+                requestChunk(cx, cy, lod, mask, PRIORITY_PREFETCH);
+        }
+    }
+}
+
 void MapScene::drawBackground(QPainter *painter, const QRectF &rect) {
     QRectF rec = sceneRect() & rect;
 
-    if (rec.isNull())
+    if (!level || rec.isNull() || chunkLayers[0].isEmpty())
         return;
 
-    for (uint y = rec.top() / TILE_SIZE; y < rec.bottom() / TILE_SIZE; y++) {
-        for (uint x = rec.left() / TILE_SIZE; x < rec.right() / TILE_SIZE; x++) {
-            // TODO: draw anything (depending on which data section is selected)
-
-            // draw data4 parts 1-3 here (visual)
-            for (int i = 2; i >= 0; i--) {
-                if (showVisual[i] && level->blocks[y][x].visual[i].first >= 0) {
-                    // (TODO: colors / tile numbers)
-                    QColor color;
-                    color.setHsv(20 * (level->blocks[y][x].visual[i].first) & 0xFF,
-                                 192,
-                                 255,
-                                 i == 1 ? 255 : 128);
-                    painter->fillRect(x * TILE_SIZE, y * TILE_SIZE, TILE_SIZE, TILE_SIZE,
-                                     color);
-                }
+    // draw from whichever level of detail suits the current zoom level,
+    // so the number of pixels drawn only depends on the size of the view
+    uint lod = detailLevel(painter->worldTransform().m11(), NumLods);
+    qreal size = CHUNK_SIZE << lod;
+    profiler.beginBackground(lod);
+
+    // visual layers go under everything else in the chunks
+    if (drawsTiles(lod))
+        drawTiles(painter, rec);
+
+    // only blit the chunks that are exposed (and queue up any that haven't
+    // been rendered with the current set of layers yet, drawing placeholders
+    // for them until they're ready)
+    uint left, top, right, bottom;
+    chunkRange(rec, lod, left, top, right, bottom);
+
+    uint shown = chunkMask(lod);
+    for (uint cy = top; cy < bottom; cy++) {
+        for (uint cx = left; cx < right; cx++) {
+            uint mask = shown & chunkLayers[lod][cy * chunksWide[lod] + cx];
+            if (!mask)
+                continue;
+
+            const QPixmap *pixmap = chunkCache.object(chunkKey(cx, cy, lod, mask));
+            profiler.countChunk(pixmap != 0);
+            if (pixmap) {
+                QRectF target(cx * size, cy * size,
+                              pixmap->width() << lod, pixmap->height() << lod);
+                painter->drawPixmap(target, *pixmap, pixmap->rect());
+            } else {
+                requestChunk(cx, cy, lod, mask, PRIORITY_VISIBLE);
+                painter->fillRect(QRectF(cx * size, cy * size, size, size) & sceneRect(),
+                                  MapScene::placeholderColor);
             }
+        }
+    }
+
+    prefetchChunks(visibleRect(), lod);
+    profiler.endBackground();
+}
 
-            // draw data3 (collision)
-            if (showCollision && level->blocks[y][x].collision > 0) {
-                // (TODO: colors / tile numbers)
-                QColor color;
-                color.setHsv(20 * (level->blocks[y][x].collision - 1) & 0xFF,
-                             255,
-                             255);
-                painter->fillRect(x * TILE_SIZE, y * TILE_SIZE, TILE_SIZE, TILE_SIZE,
-                                 color);
+/*
+  Draw the visual layers in part of the scene from the tileset, with one
+  batch of fragments (and one draw call) per layer, back to front.
+  Tiles that are past the end of the tileset are left out.
+*/
+void MapScene::drawTiles(QPainter *painter, const QRectF &rect) {
+    const MapGrid &grid = level->blocks;
+    uint left   = rect.left() / TILE_SIZE;
+    uint top    = rect.top() / TILE_SIZE;
+    uint right  = qMin((uint)ceil(rect.right() / TILE_SIZE), grid.width());
+    uint bottom = qMin((uint)ceil(rect.bottom() / TILE_SIZE), grid.height());
+
+    // (fragments are positioned by their centers, and flipped around them)
+    const qreal half = TILE_SIZE / 2.0;
+
+    for (int i = 2; i >= 0; i--) {
+        if (!showVisual[i])
+            continue;
+
+        tileFragments.resize(0);
+        for (uint y = top; y < bottom; y++) {
+            const visual_t *row = grid.visualRow(i, y);
+            for (uint x = left; x < right; x++) {
+                const visual_t &tile = row[x];
+                if (tile.first < 0 || (uint)tile.first >= atlasTiles)
+                    continue;
+                // (animated tiles point somewhere else)
+                uint entry = atlasEntries[tile.first];
+                if (entry >= atlasTiles)
+                    continue;
+
+                QPainter::PixmapFragment fragment;
+                fragment.x = x * TILE_SIZE + half;
+                fragment.y = y * TILE_SIZE + half;
+                fragment.sourceLeft = (entry % atlasColumns) * TILE_SIZE;
+                fragment.sourceTop  = (entry / atlasColumns) * TILE_SIZE;
+                fragment.width  = TILE_SIZE;
+                fragment.height = TILE_SIZE;
+                fragment.scaleX = tile.second & VISUAL_FLIP_H ? -1 : 1;
+                fragment.scaleY = tile.second & VISUAL_FLIP_V ? -1 : 1;
+                fragment.rotation = 0;
+                fragment.opacity = 1;
+                tileFragments.append(fragment);
             }
+        }
 
-            // draw data1 (breakables)
-            if (showBreakable && level->blocks[y][x].breakable > -1) {
-                // (TODO: colors / tile numbers)
-                QColor color;
-                color.setHsv(20 * (level->blocks[y][x].breakable) & 0xFF,
-                             255,
-                             255);
-                painter->fillRect(x * TILE_SIZE, y * TILE_SIZE, TILE_SIZE, TILE_SIZE,
-                                 color);
+        profiler.countTiles(tileFragments.size());
+        if (!tileFragments.isEmpty())
+            painter->drawPixmapFragments(tileFragments.constData(), tileFragments.size(),
+                                         tilesetPixmap);
+    }
+}
+
+/*
+  Which kinds of entities are currently being shown
+*/
+uint MapScene::entityMask() const {
+    uint kinds = 0;
+    if (showObjects) kinds |= 1 << EntityObject;
+    if (showItems)   kinds |= 1 << EntityItem;
+    if (showEnemies) kinds |= 1 << EntityEnemy;
+    return kinds;
+}
+
+/*
+  Convert an area of the scene to tiles, for querying the entity index
+*/
+static inline QRectF sceneToTiles(const QRectF &rect) {
+    return QRectF(rect.topLeft() / TILE_SIZE, rect.size() / TILE_SIZE);
+}
+
+/*
+  Forget about the last level's entities (the new level's get indexed as
+  they're needed, see indexEntities)
+*/
+void MapScene::buildEntities() {
+    selection.clear();
+    entityIndex.clear();
+    entityLabels.clear();
+    labelsByName.clear();
+    maxLabelSize = QSize();
+    for (uint kind = 0; kind < NumEntityKinds; kind++)
+        labelIndex[kind].clear();
+}
+
+/*
+  Make sure the given kinds of entities are indexed, and lay out a label
+  for each different name they have (every entity just points to one of
+  those). Nothing is loaded for a kind until it's first shown or picked.
+*/
+void MapScene::indexEntities(uint kinds) {
+    if (!level || !(kinds & ~entityIndex.kinds()))
+        return;
+
+    uint newKinds = kinds & ~entityIndex.kinds();
+    // (the index only has to be rebuilt once per kind per level)
+    entityIndex.build(*level, entityIndex.kinds() | kinds);
+
+    QFontMetrics metrics(MapRenderer::labelFont());
+    for (uint kind = 0; kind < NumEntityKinds; kind++) {
+        if (!(newKinds & (1 << kind)))
+            continue;
+
+        uint count = 0;
+        switch (kind) {
+        case EntityObject: count = level->objects().size(); break;
+        case EntityItem:   count = level->items().size();   break;
+        case EntityEnemy:  count = level->enemies().size(); break;
+        }
+        labelIndex[kind].resize(count);
+
+        for (uint i = 0; i < count; i++) {
+            entityref_t ref = {(EntityKind)kind, i};
+            symbol_t name = EntityIndex::name(*level, ref);
+
+            QHash<symbol_t, int>::const_iterator found = labelsByName.constFind(name);
+            if (found != labelsByName.constEnd()) {
+                labelIndex[kind][i] = found.value();
+                continue;
             }
+
+            QString infoText = symbolName(name);
+            entitylabel_t label;
+            label.text.setText(infoText);
+            label.text.setTextFormat(Qt::PlainText);
+            label.text.prepare(QTransform(), MapRenderer::labelFont());
+            label.size = metrics.boundingRect(infoText).size();
+            maxLabelSize = maxLabelSize.expandedTo(label.size);
+
+            labelIndex[kind][i] = entityLabels.size();
+            labelsByName.insert(name, entityLabels.size());
+            entityLabels.append(label);
+        }
+    }
+}
+
+/*
+  Where an entity's label is drawn in the scene
+*/
+QRectF MapScene::labelRect(const entityref_t &ref) const {
+    const entitylabel_t &label = entityLabels[labelIndex[ref.kind][ref.index]];
+    return MapRenderer::labelRect(EntityIndex::position(*level, ref) * TILE_SIZE, label.size);
+}
+
+/*
+  Get the part of the scene to look in for entities whose labels might
+  reach into an area of it (labels go up and to the right of the entity)
+*/
+QRectF MapScene::labelSearchArea(const QRectF &rect) const {
+    return rect.adjusted(-maxLabelSize.width() - 2 * MAP_TEXT_PAD_H, 0,
+                         0, maxLabelSize.height());
+}
+
+/*
+  Find the shown entity at a point in the scene: whichever label is drawn on
+  top there, or failing that, the closest entity within PICK_DISTANCE tiles
+*/
+bool MapScene::entityAt(const QPointF &pos, entityref_t &found) {
+    indexEntities(entityMask());
+    bool any = false;
+    QRectF area = labelSearchArea(QRectF(pos, QSizeF(1, 1)));
+
+    foreach (const entityref_t &ref, entityIndex.inRect(sceneToTiles(area), entityMask())) {
+        // (enemies are drawn over items over objects, and later ones over earlier ones)
+        if (labelRect(ref).contains(pos)
+                && (!any || ref.kind > found.kind
+                    || (ref.kind == found.kind && ref.index > found.index))) {
+            found = ref;
+            any = true;
         }
     }
 
+    return any || entityIndex.nearest(pos / TILE_SIZE, PICK_DISTANCE, found, entityMask());
+}
+
+/*
+  Get all of the shown entities in an area of the scene
+*/
+QVector<entityref_t> MapScene::entitiesIn(const QRectF &rect) {
+    indexEntities(entityMask());
+    return entityIndex.inRect(sceneToTiles(rect.normalized()), entityMask());
+}
+
+/*
+  When zoomed out too far for labels to be readable, lump together all the
+  entities of each kind in each MARKER_SIZE-pixel square of the screen and
+  draw one marker per lump, with the number of entities in it
+*/
+void MapScene::drawEntityMarkers(QPainter *painter, const QRectF &rect) {
+    QTransform transform = painter->worldTransform();
+    qreal cellSize = MARKER_SIZE / transform.m11();
+    QRectF area = rect.adjusted(-cellSize, -cellSize, cellSize, cellSize);
+
+    // count up how many entities are in each cell of a grid over the scene
+    QHash<quint64, uint> counts[NumEntityKinds];
+    QVector<entityref_t> found = entityIndex.inRect(sceneToTiles(area), entityMask());
+    profiler.countEntities(found.size());
+    foreach (const entityref_t &ref, found) {
+        QPointF pos = EntityIndex::position(*level, ref) * TILE_SIZE;
+        qint32 cx = floor(pos.x() / cellSize);
+        qint32 cy = floor(pos.y() / cellSize);
+        counts[ref.kind][((quint64)(quint32)cy << 32) | (quint32)cx]++;
+    }
+
+    // (markers stay the same size on screen however far out the view is)
+    const qreal radius = MARKER_SIZE / 3.0;
+
+    painter->save();
+    painter->resetTransform();
+    painter->setFont(MapRenderer::labelFont());
+    for (uint i = 0; i < NumEntityKinds; i++) {
+        painter->setBrush(MapRenderer::entityColor(i));
+        painter->setPen(Qt::black);
+
+        QHashIterator<quint64, uint> cell(counts[i]);
+        while (cell.hasNext()) {
+            cell.next();
+            qreal x = (qint32)(cell.key() & 0xFFFFFFFF) + 0.5;
+            qreal y = (qint32)(cell.key() >> 32) + 0.5;
+            // (offset each kind a bit so they don't cover each other up)
+            QPointF center = transform.map(QPointF(x * cellSize, y * cellSize))
+                           + QPointF((i - 1.0) * radius, 0);
+
+            painter->drawEllipse(center, radius, radius);
+            painter->drawText(QRectF(center.x() - radius, center.y() - radius, 2 * radius, 2 * radius),
+                              Qt::AlignCenter, QString::number(cell.value()));
+        }
+    }
+    painter->restore();
 }
 
-void MapScene::drawForeground(QPainter *painter, const QRectF& /* rect */) {
+void MapScene::drawForeground(QPainter *painter, const QRectF &rect) {
+    profiler.beginForeground();
+
     // highlight tile under cursor
-    if (tileX >= level->width && tileY < level->height && tileX > 0 && tileY > 0) {
+    if (tileX >= 0 && tileY >= 0) {
 
         painter->fillRect(tileX * TILE_SIZE, tileY * TILE_SIZE, TILE_SIZE, TILE_SIZE,
                          MapScene::infoBackColor);
@@ -508,62 +1299,107 @@ void MapScene::drawForeground(QPainter *painter, const QRectF& /* rect */) {
         painter->fillRect(selArea, MapScene::selectionColor);
     }
 
-    // draw objects (add a toggle for this later)
-    // for now just write their names
-    if (showObjects) for (uint i = 0; i < level->objects.size(); i++) {
-        const object_t &obj = level->objects[i];
-
-        QString infoText = level->objectNames[obj.type];
-        QRect infoRect = MapScene::infoFontMetrics.boundingRect(infoText);
-        double objX = (double)obj.x / 16 * TILE_SIZE;
-        // invert Y-axis
-        double objY = double(16 * level->height - obj.y) / 16 * TILE_SIZE;
-
-        painter->fillRect(objX, objY - infoRect.height() + MAP_TEXT_PAD_V,
-                         infoRect.width() + 2 * MAP_TEXT_PAD_H, infoRect.height() + MAP_TEXT_PAD_V,
-                         MapScene::objectColor);
-        painter->setFont(MapScene::infoFont);
-        painter->drawText(objX, objY - infoRect.height() + 2 * MAP_TEXT_PAD_V,
-                          infoRect.width() + 2 * MAP_TEXT_PAD_H, infoRect.height() + 2 * MAP_TEXT_PAD_V,
-                          0, infoText);
-    }
-
-    // draw items
-    if (showItems) for (uint i = 0; i < level->items.size(); i++) {
-            const item_t &obj = level->items[i];
-
-            QString infoText = QString("Item");
-            QRect infoRect = MapScene::infoFontMetrics.boundingRect(infoText);
-            double objX = (double)obj.x / 16 * TILE_SIZE;
-            // invert Y-axis
-            double objY = double(16 * level->height - obj.y) / 16 * TILE_SIZE;
-
-            painter->fillRect(objX, objY - infoRect.height() + MAP_TEXT_PAD_V,
-                             infoRect.width() + 2 * MAP_TEXT_PAD_H, infoRect.height() + MAP_TEXT_PAD_V,
-                             MapScene::itemColor);
-            painter->setFont(MapScene::infoFont);
-            painter->drawText(objX, objY - infoRect.height() + 2 * MAP_TEXT_PAD_V,
-                              infoRect.width() + 2 * MAP_TEXT_PAD_H, infoRect.height() + 2 * MAP_TEXT_PAD_V,
-                              0, infoText);
-    }
-
-    // draw enemies
-    if (showEnemies) for (uint i = 0; i < level->enemies.size(); i++) {
-            const enemy_t &obj = level->enemies[i];
-            const enemytype_t &type = level->enemyTypes[obj.type];
-
-            QString infoText = type.name;
-            QRect infoRect = MapScene::infoFontMetrics.boundingRect(infoText);
-            double objX = (double)obj.x / 16 * TILE_SIZE;
-            // invert Y-axis
-            double objY = double(16 * level->height - obj.y) / 16 * TILE_SIZE;
-
-            painter->fillRect(objX, objY - infoRect.height() + MAP_TEXT_PAD_V,
-                             infoRect.width() + 2 * MAP_TEXT_PAD_H, infoRect.height() + MAP_TEXT_PAD_V,
-                             MapScene::enemyColor);
-            painter->setFont(MapScene::infoFont);
-            painter->drawText(objX, objY - infoRect.height() + 2 * MAP_TEXT_PAD_V,
-                              infoRect.width() + 2 * MAP_TEXT_PAD_H, infoRect.height() + 2 * MAP_TEXT_PAD_V,
-                              0, infoText);
+    // draw entity selection rectangle
+    if (bandSelecting) {
+        painter->setPen(MapScene::selectionBorder);
+        painter->setBrush(MapScene::infoBackColor);
+        painter->drawRect(bandRect.normalized());
+    }
+
+    // (entities only get loaded once they're actually shown)
+    indexEntities(entityMask());
+
+    // too far out to read labels?
+    if (painter->worldTransform().m11() < LABEL_MIN_ZOOM) {
+        drawEntityMarkers(painter, rect);
+        drawProfile(painter);
+        return;
+    }
+
+    // draw the names of objects, then items, then enemies
+    // (only the ones whose labels reach into the exposed area)
+    QRectF area = labelSearchArea(rect);
+    uint shown = entityMask();
+
+    painter->setFont(MapRenderer::labelFont());
+    for (uint kind = 0; kind < NumEntityKinds; kind++) {
+        if (!(shown & (1 << kind)))
+            continue;
+
+        QVector<entityref_t> found = entityIndex.inRect(sceneToTiles(area), 1 << kind);
+        profiler.countEntities(found.size());
+        foreach (const entityref_t &ref, found) {
+            const entitylabel_t &label = entityLabels[labelIndex[kind][ref.index]];
+            QRectF labelArea = labelRect(ref);
+
+            painter->fillRect(labelArea, MapRenderer::entityColor(kind));
+            painter->drawStaticText(QPointF(labelArea.left(), labelArea.top() + MAP_TEXT_PAD_V),
+                                    label.text);
+        }
+    }
+
+    // outline selected entities
+    painter->setPen(MapScene::selectionBorder);
+    painter->setBrush(Qt::NoBrush);
+    foreach (const entityref_t &ref, selection) {
+        if (shown & (1 << ref.kind))
+            painter->drawRect(labelRect(ref));
+    }
+
+    drawProfile(painter);
+}
+
+/*
+  Finish timing a frame, and draw the profiling overlay (if it's on) in the
+  top left of the view, over everything else
+*/
+void MapScene::drawProfile(QPainter *painter) {
+    profiler.endForeground();
+    if (!profiler.isEnabled())
+        return;
+
+    painter->save();
+    painter->resetTransform();
+    profiler.drawHud(painter, QPointF(HUD_MARGIN, HUD_MARGIN));
+    painter->restore();
+}
+
+/*
+  Turn the profiling overlay on or off.
+  While it's on, views redraw everything they show whenever they scroll
+  (otherwise they'd just move the overlay along with the map)
+*/
+void MapScene::setProfiling(bool on) {
+    // (start collecting samples over from scratch each time)
+    if (on && !profiler.isEnabled())
+        profiler.clear();
+    profiler.setEnabled(on);
+    if (!profiler.isEnabled())
+        on = false;
+
+    foreach (QGraphicsView *view, views()) {
+        view->setViewportUpdateMode(on ? QGraphicsView::FullViewportUpdate
+                                       : QGraphicsView::MinimalViewportUpdate);
+        view->viewport()->update();
+    }
+
+    if (on)
+        hudTimer.start(HUD_REFRESH);
+    else
+        hudTimer.stop();
+}
+
+const RenderProfiler& MapScene::renderProfiler() const {
+    return profiler;
+}
+
+/*
+  Keep the overlay up to date when nothing else is being drawn
+  (without counting the frames that only redraw the overlay itself)
+*/
+void MapScene::refreshHud() {
+    foreach (QGraphicsView *view, views()) {
+        profiler.skipFrame();
+        view->viewport()->update(QRect(QPoint(HUD_MARGIN, HUD_MARGIN), RenderProfiler::hudSize()));
     }
 }
@@ -12,33 +12,72 @@
 #include <QtWidgets/QUndoStack>
 #include <QTimer>
 #include <QFontMetrics>
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QPainter>
+#include <QSet>
+#include <QStaticText>
+#include <QThreadPool>
+#include <QVector>
 #include <list>
 #include <vector>
 
+#include "entityindex.h"
 #include "level.h"
+#include "maprenderer.h"
+#include "renderprofiler.h"
 //#include "sceneitem.h"
 
+// an animated tile: wherever it's used, it's drawn as each of the frames
+// (tile numbers in the tileset) in turn
+struct tileanim_t {
+    int tile;
+    QVector<int> frames;
+};
+
 // subclass of QGraphicsScene used to draw the 2d map and handle mouse/kb events for it
 class MapScene : public QGraphicsScene {
     Q_OBJECT
 
 private:
-    static const QColor enemyColor, objectColor, itemColor, infoBackColor;
+    static const QColor infoBackColor;
     static const QColor selectionColor, selectionBorder;
-    static const QFont infoFont;
-    static const QFontMetrics infoFontMetrics;
+    static const QColor placeholderColor;
 
     int tileX, tileY;
     int selX, selY, selLength, selWidth;
     bool selecting;
 
+    // selected entities (and the rectangle being dragged out to select them)
+    QVector<entityref_t> selection;
+    bool bandSelecting;
+    QRectF bandRect;
+
     QUndoStack stack;
 
     LevelData *level;
 
+    // decoded tileset texture (a grid of TILE_SIZE tiles), and the atlas
+    // built from it for drawing
+    QImage tilesetImage;
     QPixmap tilesetPixmap;
+    uint atlasColumns, atlasTiles;
+    // which tile in the tileset each tile number is currently drawn as
+    // (only animated tiles ever point anywhere but themselves)
+    QVector<int> atlasEntries;
+    // (reused from frame to frame, see drawTiles)
+    QVector<QPainter::PixmapFragment> tileFragments;
     uint animFrame;
     QTimer animTimer;
+    QVector<tileanim_t> tileAnims;
+    // the parts of the scene each animation is used in (the animated cells
+    // in each chunk), which are all that get redrawn when it changes
+    QVector<QVector<QRectF> > animAreas;
+
+    // frame timings and counts, for the profiling overlay
+    RenderProfiler profiler;
+    QTimer hudTimer;
 
     bool showCollision;
     bool showVisual[3];
@@ -47,6 +86,66 @@ private:
     bool showObjects;
     bool showItems;
 
+    // each layer as an indexed image with one pixel per tile
+    // (indexed by bit number in the layer mask)
+    QImage layerImages[NumLayers];
+
+    // levels of detail for drawing the map zoomed out
+    // (each one's chunks cover twice as many tiles across as the last)
+    enum { NumLods = 7 };
+
+    // pre-rendered chunks of the map (keyed by position, level of detail
+    // and layer mask)
+    QCache<quint64, QPixmap> chunkCache;
+    // which layers have anything at all in each chunk, at each level of detail
+    QVector<uchar> chunkLayers[NumLods];
+    uint chunksWide[NumLods], chunksHigh[NumLods];
+
+    // chunks are rendered on their own threads, and drawn once they're done
+    // (results from before the last buildLayers() are thrown out)
+    friend class ChunkTask;
+    QThreadPool renderPool;
+    QSet<quint64> pendingChunks;
+    uint renderGeneration;
+    QRectF lastVisible;
+
+    // entities on the map (of the kinds that have been shown so far), and
+    // their labels (one per name, laid out ahead of time; labelIndex says
+    // which one each entity uses)
+    struct entitylabel_t {
+        QStaticText text;
+        QSize size;
+    };
+    EntityIndex entityIndex;
+    QVector<entitylabel_t> entityLabels;
+    QVector<int> labelIndex[NumEntityKinds];
+    QHash<symbol_t, int> labelsByName;
+    QSize maxLabelSize;
+
+    // everything drawn over the map that the mouse can change
+    struct overlays_t {
+        QRectF hover, tiles, band, entities;
+    };
+    overlays_t overlays() const;
+    void updateOverlays(const overlays_t &before);
+
+    bool drawsTiles(uint lod) const;
+    uint chunkMask(uint lod) const;
+    QRectF labelRect(const entityref_t&) const;
+    QRectF labelSearchArea(const QRectF&) const;
+    void buildLayers();
+    void buildEntities();
+    void indexEntities(uint kinds);
+    void buildAnimations();
+    void chunkRange(const QRectF &rect, uint lod,
+                    uint &left, uint &top, uint &right, uint &bottom) const;
+    void requestChunk(uint cx, uint cy, uint lod, uint mask, int priority);
+    void prefetchChunks(const QRectF &visible, uint lod);
+    QRectF visibleRect() const;
+    void drawTiles(QPainter *painter, const QRectF &rect);
+    void drawProfile(QPainter *painter);
+    void drawEntityMarkers(QPainter *painter, const QRectF &rect);
+
     void copyTiles(bool cut);
     void deleteTiles();
     void deleteItems();
@@ -57,6 +156,9 @@ private:
 
 public:
     MapScene(QObject *parent = 0, LevelData *currentLevel = 0);
+    ~MapScene();
+
+    void setLevel(LevelData*);
 
     bool canUndo() const;
     bool canRedo() const;
@@ -70,6 +172,22 @@ public:
 
     const QPixmap* getPixmap() const;
 
+    // finding entities on the map (only ones of the kinds being shown)
+    // (loading them, if they haven't been yet)
+    bool entityAt(const QPointF &pos, entityref_t &found);
+    QVector<entityref_t> entitiesIn(const QRectF &rect);
+    const QVector<entityref_t>& selectedEntities() const;
+
+    // which layers and kinds of entities are currently being shown
+    uint layerMask() const;
+    uint entityMask() const;
+
+    void setTileset(const QImage &image);
+    const QImage& tileset() const;
+    void setTileAnimations(const QVector<tileanim_t> &anims, int speed);
+
+    const RenderProfiler& renderProfiler() const;
+
 public slots:
     void undo();
     void redo();
@@ -83,6 +201,8 @@ public slots:
     void refresh();
     void refreshPixmap();
     void animate();
+    void setProfiling(bool);
+    void refreshHud();
 
     void setShowCollision(bool);
     void setShowFGDecor(bool);
@@ -93,8 +213,13 @@ public slots:
     void setShowObjects(bool);
     void setShowItems(bool);
 
+private slots:
+    void chunkRendered(uint generation, uint cx, uint cy, uint lod, uint mask, QImage image);
+
 signals:
     void doubleClicked();
+    void entityActivated(int kind, int index);
+    void entitiesSelected();
     void statusMessage(QString);
     void mouseOverTile(int x, int y);
     void edited();
@@ -26,81 +26,149 @@ ObjectWindow::ObjectWindow(QWidget *parent, const LevelData *level) :
     ui->tree->insertTopLevelItem(1, &enemyRoot);
     ui->tree->insertTopLevelItem(2, &objectRoot);
     ui->tree->insertTopLevelItem(3, &itemRoot);
+    // (entities can be selected from the map in bunches)
+    ui->tree->setSelectionMode(QAbstractItemView::ExtendedSelection);
 
     connect(ui->tree, SIGNAL(itemDoubleClicked(QTreeWidgetItem*,int)),
             this, SLOT(showInfo(QTreeWidgetItem*,int)));
+    connect(ui->tree, SIGNAL(itemExpanded(QTreeWidgetItem*)),
+            this, SLOT(fillItems(QTreeWidgetItem*)));
 }
 
 void ObjectWindow::setLevel(const LevelData *level) {
     this->level = level;
 }
 
+/*
+  Start showing the current level's entities. Each list is only filled in
+  (and its chunk of the map decoded) once it's expanded or something in it
+  is picked on the map.
+*/
 void ObjectWindow::update() {
-    if (!level) return;
-
-    QList<QTreeWidgetItem*> children;
-
-    // update enemies
-    children = enemyRoot.takeChildren();
-    for (int i = 0; i < children.size(); i++) {
-        delete children[i];
-    }
-    enemyRoot.setText(0, QString("Enemies (%1)").arg(level->enemies.size()));
-    for (int i = 0; i < level->enemies.size(); i++) {
-        QTreeWidgetItem *item = new QTreeWidgetItem(&enemyRoot);
-        const enemy_t &enemy = level->enemies[i];
-        const enemytype_t &type = level->enemyTypes[enemy.type];
-        item->setText(0, QString("(%1, %2) %3 (%4)")
-                      .arg(enemy.x).arg(enemy.y)
-                      .arg(type.name).arg(type.state));
-        item->setData(1, 0, i);
+    QTreeWidgetItem *roots[] = {&enemyRoot, &typeRoot, &objectRoot, &itemRoot};
+    static const char* const names[] = {"Enemies", "Enemy Types", "Objects", "Items"};
+
+    for (uint i = 0; i < 4; i++) {
+        QList<QTreeWidgetItem*> children = roots[i]->takeChildren();
+        for (int j = 0; j < children.size(); j++) {
+            delete children[j];
+        }
+
+        roots[i]->setText(0, names[i]);
+        roots[i]->setData(0, Qt::UserRole, false);
+        roots[i]->setExpanded(false);
+        roots[i]->setChildIndicatorPolicy(level ? QTreeWidgetItem::ShowIndicator
+                                                : QTreeWidgetItem::DontShowIndicator);
     }
+}
 
-    // update enemy types
-    children = typeRoot.takeChildren();
-    for (int i = 0; i < children.size(); i++) {
-        delete children[i];
-    }
-    typeRoot.setText(0, QString("Enemy Types (%1)").arg(level->enemyTypes.size()));
-    for (int i = 0; i < level->enemyTypes.size(); i++) {
-        QTreeWidgetItem *item = new QTreeWidgetItem(&typeRoot);
-        const enemytype_t &type = level->enemyTypes[i];
-        item->setText(0, QString("%1 (%2)")
-                       .arg(type.name).arg(type.state));
-        item->setData(1, 0, i);
+/*
+  Fill in one of the lists of entities, if it hasn't been already
+*/
+void ObjectWindow::fillItems(QTreeWidgetItem *root) {
+    if (!level || root->parent() || root->data(0, Qt::UserRole).toBool())
+        return;
+    root->setData(0, Qt::UserRole, true);
+    root->setChildIndicatorPolicy(QTreeWidgetItem::DontShowIndicatorWhenChildless);
+
+    if (root == &enemyRoot) {
+        enemyRoot.setText(0, QString("Enemies (%1)").arg(level->enemies().size()));
+        for (int i = 0; i < level->enemies().size(); i++) {
+            QTreeWidgetItem *item = new QTreeWidgetItem(&enemyRoot);
+            const enemy_t &enemy = level->enemies()[i];
+            QString name = "invalid";
+            if (enemy.type >= 0 && enemy.type < level->enemyTypes().size()) {
+                const enemytype_t &type = level->enemyTypes()[enemy.type];
+                name = QString("%1 (%2)").arg(symbolName(type.name)).arg(symbolName(type.state));
+            }
+
+            item->setText(0, QString("(%1, %2) %3")
+                          .arg(enemy.x).arg(enemy.y).arg(name));
+            item->setData(1, 0, i);
+        }
+
+    } else if (root == &typeRoot) {
+        typeRoot.setText(0, QString("Enemy Types (%1)").arg(level->enemyTypes().size()));
+        for (int i = 0; i < level->enemyTypes().size(); i++) {
+            QTreeWidgetItem *item = new QTreeWidgetItem(&typeRoot);
+            const enemytype_t &type = level->enemyTypes()[i];
+            item->setText(0, QString("%1 (%2)")
+                           .arg(symbolName(type.name)).arg(symbolName(type.state)));
+            item->setData(1, 0, i);
+        }
+
+    } else if (root == &objectRoot) {
+        objectRoot.setText(0, QString("Objects (%1)").arg(level->objects().size()));
+        for (int i = 0; i < level->objects().size(); i++) {
+            QTreeWidgetItem *item = new QTreeWidgetItem(&objectRoot);
+            const object_t &object = level->objects()[i];
+            QString name = "invalid";
+            if (object.type < (uint)level->objectNames().size())
+                name = symbolName(level->objectNames()[object.type]);
+
+            item->setText(0, QString("(%1, %2) %3")
+                          .arg(object.x).arg(object.y).arg(name));
+            item->setData(1, 0, i);
+        }
+
+    } else if (root == &itemRoot) {
+        itemRoot.setText(0, QString("Items (%1)").arg(level->items().size()));
+        for (int i = 0; i < level->items().size(); i++) {
+            QTreeWidgetItem *item = new QTreeWidgetItem(&itemRoot);
+            const item_t &theItem = level->items()[i];
+            item->setText(0, QString("(%1, %2) Item")
+                          .arg(theItem.x).arg(theItem.y));
+            item->setData(1, 0, i);
+        }
     }
+}
 
-    // update objects
-    children = objectRoot.takeChildren();
-    for (int i = 0; i < children.size(); i++) {
-        delete children[i];
-    }
-    objectRoot.setText(0, QString("Objects (%1)").arg(level->objects.size()));
-    for (int i = 0; i < level->objects.size(); i++) {
-        QTreeWidgetItem *item = new QTreeWidgetItem(&objectRoot);
-        const object_t &object = level->objects[i];
-        QString name = "invalid";
-        if (object.type < level->objectNames.size())
-            name = level->objectNames[object.type];
-
-        item->setText(0, QString("(%1, %2) %3")
-                      .arg(object.x).arg(object.y).arg(name));
-        item->setData(1, 0, i);
+/*
+  Find the tree item for an entity on the map
+*/
+QTreeWidgetItem* ObjectWindow::entityItem(const entityref_t &ref) {
+    QTreeWidgetItem *root = 0;
+    switch (ref.kind) {
+    case EntityObject: root = &objectRoot; break;
+    case EntityItem:   root = &itemRoot;   break;
+    case EntityEnemy:  root = &enemyRoot;  break;
+    default: return 0;
     }
 
-    // update items
-    children = itemRoot.takeChildren();
-    for (int i = 0; i < children.size(); i++) {
-        delete children[i];
-    }
-    itemRoot.setText(0, QString("Items (%1)").arg(level->items.size()));
-    for (int i = 0; i < level->items.size(); i++) {
-        QTreeWidgetItem *item = new QTreeWidgetItem(&itemRoot);
-        const item_t &theItem = level->items[i];
-        item->setText(0, QString("(%1, %2) Item")
-                      .arg(theItem.x).arg(theItem.y));
-        item->setData(1, 0, i);
+    fillItems(root);
+    return root->child(ref.index);
+}
+
+/*
+  Select an entity that was picked on the map, and show its info
+*/
+void ObjectWindow::showEntity(int kind, int index) {
+    entityref_t ref = {(EntityKind)kind, (uint)index};
+    QTreeWidgetItem *item = entityItem(ref);
+    if (!item) return;
+
+    ui->tree->setCurrentItem(item);
+    ui->tree->scrollToItem(item);
+    showInfo(item, 0);
+}
+
+/*
+  Select everything that was selected on the map
+*/
+void ObjectWindow::selectEntities(const QVector<entityref_t> &entities) {
+    ui->tree->clearSelection();
+
+    QTreeWidgetItem *last = 0;
+    foreach (const entityref_t &ref, entities) {
+        QTreeWidgetItem *item = entityItem(ref);
+        if (item) {
+            item->setSelected(true);
+            last = item;
+        }
     }
+
+    if (last)
+        ui->tree->scrollToItem(last);
 }
 
 void ObjectWindow::showInfo(QTreeWidgetItem *item, int /* column */) {
@@ -111,7 +179,7 @@ void ObjectWindow::showInfo(QTreeWidgetItem *item, int /* column */) {
 
     // show enemy info
     if (parent == &enemyRoot) {
-        const enemy_t enemy = level->enemies[num];
+        const enemy_t enemy = level->enemies()[num];
         info = "%1, %2, %3\n%4, %5";
         for (uint i = 0; i < 3; i++)
             info = info.arg(enemy.data1[i]);
@@ -119,14 +187,14 @@ void ObjectWindow::showInfo(QTreeWidgetItem *item, int /* column */) {
             info = info.arg(enemy.data2[i]);
 
     } else if (parent == &objectRoot) {
-        const object_t obj = level->objects[num];
+        const object_t obj = level->objects()[num];
         info = "Unknown: %1\nEnabled: %2\nParams: %3, %4, %5, %6, %7, %8, %9, %10";
         info = info.arg(obj.unknown).arg(obj.enabled ? "true" : "false");
         for (uint i = 0; i < 8; i++)
             info = info.arg(obj.params[i]);
 
     } else if (parent == &itemRoot) {
-        const item_t itm = level->items[num];
+        const item_t itm = level->items()[num];
         info = "%1, %2, %3, %4";
         for (uint i = 0; i < 3; i++)
             info = info.arg(itm.data[i]);
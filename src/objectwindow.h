@@ -4,6 +4,7 @@
 #include <QWidget>
 #include <QTreeWidget>
 
+#include "entityindex.h"
 #include "level.h"
 
 namespace Ui {
@@ -21,10 +22,17 @@ public:
     void setLevel(const LevelData*);
     void update();
 
+public slots:
+    void showEntity(int kind, int index);
+    void selectEntities(const QVector<entityref_t>&);
+
 private slots:
     void showInfo(QTreeWidgetItem * item, int column);
+    void fillItems(QTreeWidgetItem *root);
 
 private:
+    QTreeWidgetItem* entityItem(const entityref_t&);
+
     Ui::ObjectWindow *ui;
     const LevelData *level;
 
@@ -0,0 +1,313 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#include <QtGlobal>
+#include <QtEndian>
+#include <cstdlib>
+#include <cstring>
+#include "pngwriter.h"
+
+#ifndef TRISTAR_NO_ZLIB
+#include <zlib.h>
+#endif
+
+// how much compressed data goes in each IDAT chunk
+#define IDAT_SIZE (64 << 10)
+// biggest stored deflate block (without zlib)
+#define STORED_BLOCK_SIZE 65535
+
+// PNG row filters
+enum {
+    FilterNone,
+    FilterSub,
+    FilterUp,
+    FilterAverage,
+    FilterPaeth,
+    NumFilters
+};
+
+/*
+  CRC-32 for chunks (the same one zlib has, but that might not be here)
+*/
+struct crctable_t {
+    uint32_t table[256];
+
+    crctable_t() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; j++)
+                crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+            table[i] = crc;
+        }
+    }
+};
+
+static uint32_t crc32Update(uint32_t crc, const char *data, size_t size) {
+    static const crctable_t crcs;
+    for (size_t i = 0; i < size; i++)
+        crc = crcs.table[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef TRISTAR_NO_ZLIB
+static uint32_t adler32Update(uint32_t adler, const char *data, size_t size) {
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    while (size) {
+        // (how many bytes can be summed before b could overflow)
+        size_t count = qMin<size_t>(size, 5552);
+        size -= count;
+        while (count--) {
+            a += (uint8_t)*data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+#endif
+
+static inline uint8_t paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+/*
+  Filter a row of bytes (4 per pixel) with one of the PNG filters.
+  Returns the sum of the filtered bytes taken as signed values, which is
+  the usual guess at how well a row will compress (lower is better).
+*/
+static uint32_t filterRow(uint8_t *dst, const uint8_t *row, const uint8_t *last,
+                          size_t size, int filter) {
+    uint32_t sum = 0;
+    dst[0] = filter;
+    dst++;
+
+    for (size_t i = 0; i < size; i++) {
+        int left = i >= 4 ? row[i - 4] : 0;
+        int up   = last[i];
+        int upLeft = i >= 4 ? last[i - 4] : 0;
+
+        uint8_t value;
+        switch (filter) {
+        case FilterSub:     value = row[i] - left; break;
+        case FilterUp:      value = row[i] - up; break;
+        case FilterAverage: value = row[i] - ((left + up) >> 1); break;
+        case FilterPaeth:   value = row[i] - paeth(left, up, upLeft); break;
+        default:            value = row[i]; break;
+        }
+
+        dst[i] = value;
+        sum += value < 128 ? value : 256 - value;
+    }
+
+    return sum;
+}
+
+PngWriter::PngWriter(QIODevice *device)
+    : device(device),
+      width(0), height(0), rowsWritten(0),
+      error(0)
+#ifndef TRISTAR_NO_ZLIB
+      , stream(0)
+#else
+      , adler(1)
+#endif
+{}
+
+PngWriter::~PngWriter() {
+#ifndef TRISTAR_NO_ZLIB
+    if (stream) {
+        deflateEnd(stream);
+        delete stream;
+    }
+#endif
+}
+
+const char* PngWriter::errorString() const {
+    return error ? error : "No error";
+}
+
+bool PngWriter::fail(const char *why) {
+    if (!error)
+        error = why;
+    return false;
+}
+
+bool PngWriter::writeChunk(const char *type, const char *data, size_t size) {
+    uchar header[8];
+    qToBigEndian<quint32>(size, header);
+    memcpy(header + 4, type, 4);
+
+    uint32_t crc = crc32Update(0xFFFFFFFF, type, 4);
+    crc = crc32Update(crc, data, size) ^ 0xFFFFFFFF;
+    uchar footer[4];
+    qToBigEndian<quint32>(crc, footer);
+
+    if (device->write((const char*)header, 8) != 8
+        || device->write(data, size) != (qint64)size
+        || device->write((const char*)footer, 4) != 4)
+        return fail("Unable to write the image.");
+
+    return true;
+}
+
+bool PngWriter::begin(uint32_t width, uint32_t height) {
+    if (!width || !height || width > 0x7FFFFFFF / 4 || height > 0x7FFFFFFF)
+        return fail("Invalid image size.");
+
+    this->width = width;
+    this->height = height;
+    rowsWritten = 0;
+
+    lastRow.fill(0, width * 4);
+    thisRow.resize(width * 4);
+    filtered.resize(width * 4 + 1);
+    bestFiltered.resize(width * 4 + 1);
+    idat.reserve(IDAT_SIZE);
+
+#ifndef TRISTAR_NO_ZLIB
+    stream = new z_stream;
+    memset(stream, 0, sizeof(z_stream));
+    if (deflateInit(stream, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        delete stream;
+        stream = 0;
+        return fail("Unable to start compressing the image.");
+    }
+#else
+    // zlib header (no compression)
+    idat.append((char)0x78);
+    idat.append((char)0x01);
+#endif
+
+    static const char signature[8] = {'\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n'};
+    if (device->write(signature, 8) != 8)
+        return fail("Unable to write the image.");
+
+    // 8 bits per channel, RGBA, default compression/filtering, no interlacing
+    uchar ihdr[13];
+    qToBigEndian<quint32>(width, ihdr);
+    qToBigEndian<quint32>(height, ihdr + 4);
+    ihdr[8] = 8;
+    ihdr[9] = 6;
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    return writeChunk("IHDR", (const char*)ihdr, 13);
+}
+
+/*
+  Compress some more of the image data, writing out IDAT chunks whenever
+  there's enough for one (or everything that's left if finishing)
+*/
+bool PngWriter::compress(const char *data, size_t size, bool finish) {
+#ifndef TRISTAR_NO_ZLIB
+    if (!stream)
+        return fail("The image wasn't started.");
+
+    stream->next_in = (Bytef*)data;
+    stream->avail_in = size;
+
+    int result;
+    do {
+        int used = idat.size();
+        idat.resize(IDAT_SIZE);
+        stream->next_out = (Bytef*)idat.data() + used;
+        stream->avail_out = IDAT_SIZE - used;
+
+        result = deflate(stream, finish ? Z_FINISH : Z_NO_FLUSH);
+        if (result == Z_STREAM_ERROR)
+            return fail("Unable to compress the image.");
+        idat.resize(IDAT_SIZE - stream->avail_out);
+
+        if (idat.size() == IDAT_SIZE || (finish && result == Z_STREAM_END)) {
+            if (!writeChunk("IDAT", idat.constData(), idat.size()))
+                return false;
+            idat.resize(0);
+        }
+    } while (stream->avail_in || (finish && result != Z_STREAM_END));
+
+#else
+    adler = adler32Update(adler, data, size);
+
+    // (each row gets its own stored blocks)
+    do {
+        size_t count = qMin<size_t>(size, STORED_BLOCK_SIZE);
+        uchar header[5];
+        header[0] = finish && count == size;
+        qToLittleEndian<quint16>(count, header + 1);
+        qToLittleEndian<quint16>(~count, header + 3);
+        idat.append((const char*)header, 5);
+        idat.append(data, count);
+        data += count;
+        size -= count;
+
+        if (idat.size() >= IDAT_SIZE) {
+            if (!writeChunk("IDAT", idat.constData(), idat.size()))
+                return false;
+            idat.resize(0);
+        }
+    } while (size);
+
+    if (finish) {
+        uchar footer[4];
+        qToBigEndian<quint32>(adler, footer);
+        idat.append((const char*)footer, 4);
+        if (!writeChunk("IDAT", idat.constData(), idat.size()))
+            return false;
+        idat.resize(0);
+    }
+#endif
+
+    return true;
+}
+
+bool PngWriter::writeRows(const uint32_t *pixels, size_t stride, uint32_t rows) {
+    if (error)
+        return false;
+    if (rows > height - rowsWritten)
+        return fail("Too many rows written to the image.");
+
+    for (uint32_t y = 0; y < rows; y++) {
+        const uint32_t *row = pixels + y * stride;
+        uint8_t *bytes = (uint8_t*)thisRow.data();
+        for (uint32_t x = 0; x < width; x++) {
+            bytes[4 * x]     = row[x] >> 16;
+            bytes[4 * x + 1] = row[x] >> 8;
+            bytes[4 * x + 2] = row[x];
+            bytes[4 * x + 3] = row[x] >> 24;
+        }
+
+        // try every filter and keep whichever looks like it'll compress best
+        const uint8_t *last = (const uint8_t*)lastRow.constData();
+        uint32_t bestSum = 0xFFFFFFFF;
+        for (int filter = 0; filter < NumFilters; filter++) {
+            uint32_t sum = filterRow((uint8_t*)filtered.data(), bytes, last, width * 4, filter);
+            if (sum < bestSum) {
+                bestSum = sum;
+                qSwap(filtered, bestFiltered);
+            }
+        }
+
+        if (!compress(bestFiltered.constData(), bestFiltered.size(), false))
+            return false;
+        qSwap(lastRow, thisRow);
+        rowsWritten++;
+    }
+
+    return true;
+}
+
+bool PngWriter::end() {
+    if (error)
+        return false;
+    if (rowsWritten != height)
+        return fail("Not all of the image's rows were written.");
+
+    if (!compress(0, 0, true))
+        return false;
+    return writeChunk("IEND", 0, 0);
+}
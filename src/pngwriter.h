@@ -0,0 +1,61 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include <QIODevice>
+#include <QByteArray>
+#include <cstdint>
+
+struct z_stream_s;
+
+/*
+  Writes a PNG (8-bit RGBA) a few rows at a time, so that only the rows
+  being written have to be in memory, no matter how big the whole image is.
+
+  Rows are compressed with zlib, unless built with TRISTAR_NO_ZLIB, in which
+  case they're just stored (still a valid PNG, only a much bigger one).
+*/
+class PngWriter {
+public:
+    explicit PngWriter(QIODevice *device);
+    ~PngWriter();
+
+    // write the PNG header for an image of a given size
+    bool begin(uint32_t width, uint32_t height);
+    // write the next rows of the image, as non-premultiplied ARGB32 pixels
+    // (same layout as QRgb); stride is in pixels, not bytes
+    bool writeRows(const uint32_t *pixels, size_t stride, uint32_t rows);
+    // finish the image (after all of its rows have been written)
+    bool end();
+
+    const char* errorString() const;
+
+private:
+    Q_DISABLE_COPY(PngWriter)
+
+    QIODevice *device;
+    uint32_t width, height, rowsWritten;
+    const char *error;
+
+    // the last row (unfiltered, for filtering the next one against),
+    // the current one, and the best way found to filter it so far
+    QByteArray lastRow, thisRow, filtered, bestFiltered;
+
+    // compressed data waiting to go out in the next IDAT chunk
+    QByteArray idat;
+#ifndef TRISTAR_NO_ZLIB
+    z_stream_s *stream;
+#else
+    uint32_t adler;
+#endif
+
+    bool compress(const char *data, size_t size, bool finish);
+    bool writeChunk(const char *type, const char *data, size_t size);
+    bool fail(const char *why);
+};
+
+#endif // PNGWRITER_H
@@ -0,0 +1,154 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#include <QPainter>
+#include <algorithm>
+#include <cstring>
+#include "renderprofiler.h"
+
+// most frames kept for dumping to CSV
+#define MAX_SAMPLES 65536
+// how many of the latest frames the percentiles and histogram cover
+#define HUD_FRAMES 240
+// size of the overlay (in pixels)
+#define HUD_WIDTH   (HUD_FRAMES + 16)
+#define HUD_TEXT    64
+#define HUD_GRAPH   48
+// frame time budget marked on the histogram (60 fps, in msec)
+#define HUD_BUDGET  (1000.0 / 60)
+
+static const QColor hudBackColor(0, 0, 0, 192);
+static const QColor hudTextColor(255, 255, 255);
+static const QColor hudBarColor(128, 224, 128);
+static const QColor hudSlowColor(255, 128, 128);
+
+static inline double msecs(qint64 nsecs) {
+    return nsecs / 1000000.0;
+}
+
+RenderProfiler::RenderProfiler()
+    : enabled(false), skipNext(false), next(0)
+{
+    memset(&frame, 0, sizeof(frame));
+}
+
+void RenderProfiler::setEnabled(bool on) {
+#ifndef TRISTAR_NO_PROFILER
+    enabled = on;
+#else
+    Q_UNUSED(on);
+#endif
+    memset(&frame, 0, sizeof(frame));
+}
+
+void RenderProfiler::clear() {
+    history.clear();
+    next = 0;
+    memset(&frame, 0, sizeof(frame));
+}
+
+void RenderProfiler::endFrame() {
+    if (skipNext) {
+        skipNext = false;
+    } else if (history.size() < MAX_SAMPLES) {
+        history.append(frame);
+    } else {
+        history[next] = frame;
+        next = (next + 1) % MAX_SAMPLES;
+    }
+
+    memset(&frame, 0, sizeof(frame));
+}
+
+QVector<framesample_t> RenderProfiler::samples() const {
+    if (history.size() < MAX_SAMPLES)
+        return history;
+    return history.mid(next) + history.mid(0, next);
+}
+
+bool RenderProfiler::writeCsv(QIODevice *device) const {
+    QByteArray csv("frame,background_ms,foreground_ms,total_ms,lod,tiles,chunks,"
+                   "entities,cache_hits,cache_misses\n");
+    QVector<framesample_t> frames = samples();
+    for (int i = 0; i < frames.size(); i++) {
+        const framesample_t &sample = frames[i];
+        csv += QString("%1,%2,%3,%4,%5,%6,%7,%8,%9,%10\n")
+               .arg(i)
+               .arg(msecs(sample.background), 0, 'f', 3)
+               .arg(msecs(sample.foreground), 0, 'f', 3)
+               .arg(msecs(sample.total()), 0, 'f', 3)
+               .arg(sample.lod).arg(sample.tiles).arg(sample.chunks)
+               .arg(sample.entities).arg(sample.cacheHits).arg(sample.cacheMisses)
+               .toLatin1();
+    }
+
+    return device->write(csv) == csv.size();
+}
+
+qint64 RenderProfiler::percentile(QVector<qint64> &times, int pct) const {
+    if (times.isEmpty())
+        return 0;
+
+    int n = qMin(times.size() - 1, times.size() * pct / 100);
+    std::nth_element(times.begin(), times.begin() + n, times.end());
+    return times[n];
+}
+
+QSize RenderProfiler::hudSize() {
+    return QSize(HUD_WIDTH, HUD_TEXT + HUD_GRAPH + 8);
+}
+
+void RenderProfiler::drawHud(QPainter *painter, const QPointF &pos) const {
+    QVector<framesample_t> frames = samples();
+    frames = frames.mid(qMax(0, frames.size() - HUD_FRAMES));
+    framesample_t last;
+    memset(&last, 0, sizeof(last));
+    if (!frames.isEmpty())
+        last = frames.last();
+
+    QVector<qint64> times;
+    qint64 slowest = 0;
+    foreach (const framesample_t &sample, frames) {
+        times.append(sample.total());
+        slowest = qMax(slowest, sample.total());
+    }
+
+    painter->save();
+    QRectF area(pos, hudSize());
+    painter->fillRect(area, hudBackColor);
+
+    QFont font("Consolas", 8);
+    font.setStyleHint(QFont::TypeWriter);
+    painter->setFont(font);
+    painter->setPen(hudTextColor);
+
+    QString text = QString("background %1 ms  foreground %2 ms\n"
+                           "tiles %3  entities %4  lod %5\n"
+                           "chunks %6  (cache %7 hit / %8 miss)\n"
+                           "p50 %9  p95 %10  p99 %11 ms")
+                   .arg(msecs(last.background), 0, 'f', 2)
+                   .arg(msecs(last.foreground), 0, 'f', 2)
+                   .arg(last.tiles).arg(last.entities).arg(last.lod)
+                   .arg(last.chunks).arg(last.cacheHits).arg(last.cacheMisses)
+                   .arg(msecs(percentile(times, 50)), 0, 'f', 2)
+                   .arg(msecs(percentile(times, 95)), 0, 'f', 2)
+                   .arg(msecs(percentile(times, 99)), 0, 'f', 2);
+    painter->drawText(area.adjusted(8, 4, -8, 0), Qt::AlignLeft | Qt::AlignTop, text);
+
+    // one bar per frame, scaled so the budget line is always on the graph
+    double scale = HUD_GRAPH / qMax(HUD_BUDGET, msecs(slowest));
+    qreal bottom = area.bottom() - 4;
+    for (int i = 0; i < frames.size(); i++) {
+        double time = msecs(frames[i].total());
+        painter->fillRect(QRectF(area.left() + 8 + i, bottom - time * scale, 1, time * scale),
+                          time > HUD_BUDGET ? hudSlowColor : hudBarColor);
+    }
+
+    painter->setPen(hudSlowColor);
+    painter->drawLine(QPointF(area.left() + 8, bottom - HUD_BUDGET * scale),
+                      QPointF(area.right() - 8, bottom - HUD_BUDGET * scale));
+
+    painter->restore();
+}
@@ -0,0 +1,126 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef RENDERPROFILER_H
+#define RENDERPROFILER_H
+
+#include <QElapsedTimer>
+#include <QIODevice>
+#include <QPointF>
+#include <QSize>
+#include <QVector>
+
+class QPainter;
+
+// what went into drawing one frame of the map view
+struct framesample_t {
+    qint64 background, foreground; // nsecs
+    uint tiles, chunks, entities;
+    uint cacheHits, cacheMisses;
+    uint lod;
+
+    qint64 total() const { return background + foreground; }
+};
+
+/*
+  Collects timings and counts from MapScene while it draws, for finding out
+  where the time goes when panning/zooming is slow, and draws them as an
+  overlay on the map view.
+
+  All of the counting functions are inline and do nothing (besides check
+  whether profiling is turned on) unless it is, and compile away to
+  nothing at all when built with TRISTAR_NO_PROFILER.
+*/
+class RenderProfiler {
+public:
+    RenderProfiler();
+
+    bool isEnabled() const { return enabled; }
+    void setEnabled(bool on);
+    void clear();
+
+    // the samples collected so far (oldest first)
+    QVector<framesample_t> samples() const;
+    bool writeCsv(QIODevice *device) const;
+
+    // draw the latest frame's numbers and a histogram of recent frame times
+    // (in device coordinates)
+    void drawHud(QPainter *painter, const QPointF &pos) const;
+    static QSize hudSize();
+
+    inline void beginBackground(uint lod) {
+#ifndef TRISTAR_NO_PROFILER
+        if (enabled) {
+            frame.lod = lod;
+            timer.start();
+        }
+#else
+        Q_UNUSED(lod);
+#endif
+    }
+    inline void endBackground() {
+#ifndef TRISTAR_NO_PROFILER
+        if (enabled) frame.background += timer.nsecsElapsed();
+#endif
+    }
+    inline void beginForeground() {
+#ifndef TRISTAR_NO_PROFILER
+        if (enabled) timer.start();
+#endif
+    }
+    // (a frame ends with its foreground, since that's drawn last)
+    inline void endForeground() {
+#ifndef TRISTAR_NO_PROFILER
+        if (enabled) {
+            frame.foreground += timer.nsecsElapsed();
+            endFrame();
+        }
+#endif
+    }
+
+    inline void countTiles(uint count) {
+#ifndef TRISTAR_NO_PROFILER
+        if (enabled) frame.tiles += count;
+#else
+        Q_UNUSED(count);
+#endif
+    }
+    inline void countEntities(uint count) {
+#ifndef TRISTAR_NO_PROFILER
+        if (enabled) frame.entities += count;
+#else
+        Q_UNUSED(count);
+#endif
+    }
+    inline void countChunk(bool cached) {
+#ifndef TRISTAR_NO_PROFILER
+        if (enabled) {
+            frame.chunks++;
+            if (cached) frame.cacheHits++;
+            else        frame.cacheMisses++;
+        }
+#else
+        Q_UNUSED(cached);
+#endif
+    }
+
+    // don't keep the next frame (see MapScene::refreshHud)
+    void skipFrame() { skipNext = true; }
+
+private:
+    bool enabled, skipNext;
+    QElapsedTimer timer;
+    framesample_t frame;
+
+    // every frame so far, up to a limit (after that, the oldest ones get
+    // replaced first)
+    QVector<framesample_t> history;
+    int next;
+
+    void endFrame();
+    qint64 percentile(QVector<qint64> &times, int pct) const;
+};
+
+#endif // RENDERPROFILER_H
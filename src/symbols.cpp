@@ -0,0 +1,84 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#include "symbols.h"
+
+SymbolTable::SymbolTable() {
+    // the empty string is always symbol 0
+    intern("", 0);
+}
+
+SymbolTable& SymbolTable::global() {
+    static SymbolTable table;
+    return table;
+}
+
+/*
+  Get the symbol for a name, adding it to the table if it's new.
+  Names that are already in the table only take a read lock.
+*/
+symbol_t SymbolTable::intern(const char *chars, uint length) {
+    const QByteArray key = QByteArray::fromRawData(chars, length);
+
+    {
+        QReadLocker read(&lock);
+        QHash<QByteArray, symbol_t>::const_iterator i = symbols.constFind(key);
+        if (i != symbols.constEnd())
+            return i.value();
+    }
+
+    QWriteLocker write(&lock);
+    // (someone else may have added it in the meantime)
+    QHash<QByteArray, symbol_t>::const_iterator i = symbols.constFind(key);
+    if (i != symbols.constEnd())
+        return i.value();
+
+    arenastr_t name = arena.copyString(chars, length);
+    symbol_t symbol = names.size();
+    names.append(name);
+    symbols.insert(name.bytes(), symbol);
+    return symbol;
+}
+
+/*
+  Get the symbols for a list of names at once (e.g. a cache entry's whole
+  symbol table), only taking the write lock once instead of once per name.
+*/
+void SymbolTable::internAll(const arenastr_t *names, uint count, symbol_t *symbols) {
+    QWriteLocker write(&lock);
+
+    for (uint i = 0; i < count; i++) {
+        const QByteArray key = names[i].bytes();
+        QHash<QByteArray, symbol_t>::const_iterator found = this->symbols.constFind(key);
+        if (found != this->symbols.constEnd()) {
+            symbols[i] = found.value();
+            continue;
+        }
+
+        arenastr_t name = arena.copyString(names[i].chars, names[i].length);
+        symbols[i] = this->names.size();
+        this->names.append(name);
+        this->symbols.insert(name.bytes(), symbols[i]);
+    }
+}
+
+QByteArray SymbolTable::bytes(symbol_t symbol) const {
+    QReadLocker read(&lock);
+    if (symbol >= (uint)names.size())
+        return QByteArray();
+    return names[symbol].bytes();
+}
+
+QString SymbolTable::string(symbol_t symbol) const {
+    QReadLocker read(&lock);
+    if (symbol >= (uint)names.size())
+        return QString();
+    return names[symbol].toString();
+}
+
+uint SymbolTable::size() const {
+    QReadLocker read(&lock);
+    return names.size();
+}
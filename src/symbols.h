@@ -0,0 +1,69 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QReadWriteLock>
+#include <QString>
+#include <QVector>
+#include <cstdint>
+
+#include "arena.h"
+
+// an interned name (enemy, enemy type, object...)
+// two symbols are equal only if their names are
+typedef uint32_t symbol_t;
+
+// the symbol for the empty string
+#define NO_SYMBOL 0
+
+/*
+  Maps names to compact 32-bit symbols and back.
+  There's one table for the whole process, shared by every loaded map, so
+  a name that appears in thousands of maps is only stored once. Symbols
+  (and their names) are never freed.
+  Safe to use from any thread.
+*/
+class SymbolTable {
+public:
+    static SymbolTable& global();
+
+    symbol_t intern(const char*, uint length);
+    symbol_t intern(const QByteArray &bytes) {
+        return intern(bytes.constData(), bytes.size());
+    }
+    // intern a whole list of names at once, taking the lock only once
+    // (symbols[i] is set to the symbol for names[i])
+    void internAll(const arenastr_t *names, uint count, symbol_t *symbols);
+
+    // name of a symbol (these stay valid forever, so this doesn't copy)
+    QByteArray bytes(symbol_t) const;
+    QString string(symbol_t) const;
+
+    uint size() const;
+
+private:
+    SymbolTable();
+    Q_DISABLE_COPY(SymbolTable)
+
+    mutable QReadWriteLock lock;
+    // (the keys point into the arena)
+    QHash<QByteArray, symbol_t> symbols;
+    QVector<arenastr_t> names;
+    Arena arena;
+};
+
+static inline symbol_t internSymbol(const QByteArray &bytes) {
+    return SymbolTable::global().intern(bytes);
+}
+
+static inline QString symbolName(symbol_t symbol) {
+    return SymbolTable::global().string(symbol);
+}
+
+#endif // SYMBOLS_H
@@ -0,0 +1,430 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#include <QtGlobal>
+#include <QtEndian>
+#include <cstring>
+#include "byteswap.h"
+#include "texture.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_SSE2
+#include <emmintrin.h>
+#endif
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+// biggest block used by any format (in pixels)
+#define MAX_BLOCK_PIXELS 64
+
+const char* textureFormatName(TextureFormat format) {
+    static const char *names[NumTextureFormats] = {
+        "RGB565 (3DS)",
+        "RGBA4444 (3DS)",
+        "ETC1 (3DS)",
+        "ETC1A4 (3DS)",
+        "RGB5A3 (Wii)",
+        "CMPR (Wii)"
+    };
+    return format < NumTextureFormats ? names[format] : "unknown";
+}
+
+/*
+  Size of each format's blocks (in pixels) and how many bits each pixel takes
+*/
+struct texformat_t {
+    u32 blockWidth, blockHeight;
+    u32 bitsPerPixel;
+    bool bigEndian, upsideDown;
+};
+
+static const texformat_t formats[NumTextureFormats] = {
+    {8, 8, 16, false, true},  // RGB565
+    {8, 8, 16, false, true},  // RGBA4444
+    {8, 8, 4,  false, true},  // ETC1
+    {8, 8, 8,  false, true},  // ETC1A4
+    {4, 4, 16, true,  false}, // RGB5A3
+    {8, 8, 4,  true,  false}  // CMPR
+};
+
+static inline u32 paddedTo(u32 size, u32 block) {
+    return (size + block - 1) / block * block;
+}
+
+size_t textureSize(TextureFormat format, u32 width, u32 height) {
+    if (format >= NumTextureFormats)
+        return 0;
+
+    const texformat_t &info = formats[format];
+    return (size_t)paddedTo(width, info.blockWidth) * paddedTo(height, info.blockHeight)
+         * info.bitsPerPixel / 8;
+}
+
+u32 textureHeight(TextureFormat format, u32 width, size_t dataSize) {
+    if (format >= NumTextureFormats || !width)
+        return 0;
+
+    // (whole rows of blocks only)
+    const texformat_t &info = formats[format];
+    size_t rowSize = textureSize(format, width, info.blockHeight);
+    return dataSize / rowSize * info.blockHeight;
+}
+
+/*
+  Color channel expansion (n bits -> 8 bits, repeating the high bits)
+*/
+static inline u32 expand3(u32 c) { return (c << 5) | (c << 2) | (c >> 1); }
+static inline u32 expand4(u32 c) { return c * 0x11; }
+static inline u32 expand5(u32 c) { return (c << 3) | (c >> 2); }
+static inline u32 expand6(u32 c) { return (c << 2) | (c >> 4); }
+
+static inline u32 argb(u32 a, u32 r, u32 g, u32 b) {
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+static inline u32 pixelRGB565(u32 v) {
+    return argb(0xFF, expand5(v >> 11), expand6((v >> 5) & 0x3F), expand5(v & 0x1F));
+}
+
+static inline u32 pixelRGBA4444(u32 v) {
+    return argb(expand4(v & 0xF), expand4(v >> 12), expand4((v >> 8) & 0xF), expand4((v >> 4) & 0xF));
+}
+
+static inline u32 pixelRGB5A3(u32 v) {
+    // top bit set: opaque RGB555, otherwise A3 RGB444
+    if (v & 0x8000)
+        return argb(0xFF, expand5((v >> 10) & 0x1F), expand5((v >> 5) & 0x1F), expand5(v & 0x1F));
+    return argb(expand3((v >> 12) & 7), expand4((v >> 8) & 0xF), expand4((v >> 4) & 0xF), expand4(v & 0xF));
+}
+
+typedef void (*expandfunc_t)(u32 *dst, const u16 *src, size_t count);
+
+/*
+  scalar kernels (also used for whatever is left over after the SIMD ones)
+*/
+static void expandRGB565Scalar(u32 *dst, const u16 *src, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        dst[i] = pixelRGB565(src[i]);
+}
+
+static void expandRGBA4444Scalar(u32 *dst, const u16 *src, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        dst[i] = pixelRGBA4444(src[i]);
+}
+
+static void expandRGB5A3Scalar(u32 *dst, const u16 *src, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        dst[i] = pixelRGB5A3(src[i]);
+}
+
+#ifdef TEXTURE_SSE2
+/*
+  SSE2 kernels (8 texels per iteration: each channel is expanded in 16-bit
+  lanes, then the "GB" and "AR" halves of each pixel are interleaved)
+*/
+static inline void storePixels(u32 *dst, __m128i a, __m128i r, __m128i g, __m128i b) {
+    __m128i gb = _mm_or_si128(_mm_slli_epi16(g, 8), b);
+    __m128i ar = _mm_or_si128(_mm_slli_epi16(a, 8), r);
+    _mm_storeu_si128((__m128i*)dst,       _mm_unpacklo_epi16(gb, ar));
+    _mm_storeu_si128((__m128i*)(dst + 4), _mm_unpackhi_epi16(gb, ar));
+}
+
+static inline __m128i expand4SSE2(__m128i c) {
+    return _mm_or_si128(_mm_slli_epi16(c, 4), c);
+}
+
+static inline __m128i expand5SSE2(__m128i c) {
+    return _mm_or_si128(_mm_slli_epi16(c, 3), _mm_srli_epi16(c, 2));
+}
+
+static void expandRGB565SSE2(u32 *dst, const u16 *src, size_t count) {
+    const __m128i mask5 = _mm_set1_epi16(0x1F);
+    const __m128i mask6 = _mm_set1_epi16(0x3F);
+    const __m128i alpha = _mm_set1_epi16(0xFF);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i r = _mm_srli_epi16(v, 11);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), mask6);
+        __m128i b = _mm_and_si128(v, mask5);
+
+        g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+        storePixels(dst + i, alpha, expand5SSE2(r), g, expand5SSE2(b));
+    }
+    expandRGB565Scalar(dst + i, src + i, count - i);
+}
+
+static void expandRGBA4444SSE2(u32 *dst, const u16 *src, size_t count) {
+    const __m128i mask4 = _mm_set1_epi16(0xF);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i r = _mm_srli_epi16(v, 12);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(v, 8), mask4);
+        __m128i b = _mm_and_si128(_mm_srli_epi16(v, 4), mask4);
+        __m128i a = _mm_and_si128(v, mask4);
+
+        storePixels(dst + i, expand4SSE2(a), expand4SSE2(r), expand4SSE2(g), expand4SSE2(b));
+    }
+    expandRGBA4444Scalar(dst + i, src + i, count - i);
+}
+
+static void expandRGB5A3SSE2(u32 *dst, const u16 *src, size_t count) {
+    const __m128i mask3 = _mm_set1_epi16(0x7);
+    const __m128i mask4 = _mm_set1_epi16(0xF);
+    const __m128i mask5 = _mm_set1_epi16(0x1F);
+    const __m128i alpha = _mm_set1_epi16(0xFF);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        // (all ones in the lanes with the top bit set)
+        __m128i opaque = _mm_srai_epi16(v, 15);
+
+        // do both kinds of texel, then pick one for each lane
+        __m128i r5 = expand5SSE2(_mm_and_si128(_mm_srli_epi16(v, 10), mask5));
+        __m128i g5 = expand5SSE2(_mm_and_si128(_mm_srli_epi16(v, 5), mask5));
+        __m128i b5 = expand5SSE2(_mm_and_si128(v, mask5));
+
+        __m128i a3 = _mm_and_si128(_mm_srli_epi16(v, 12), mask3);
+        a3 = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(a3, 5), _mm_slli_epi16(a3, 2)),
+                          _mm_srli_epi16(a3, 1));
+        __m128i r4 = expand4SSE2(_mm_and_si128(_mm_srli_epi16(v, 8), mask4));
+        __m128i g4 = expand4SSE2(_mm_and_si128(_mm_srli_epi16(v, 4), mask4));
+        __m128i b4 = expand4SSE2(_mm_and_si128(v, mask4));
+
+#define SELECT(x, y) _mm_or_si128(_mm_and_si128(opaque, x), _mm_andnot_si128(opaque, y))
+        storePixels(dst + i, SELECT(alpha, a3), SELECT(r5, r4), SELECT(g5, g4), SELECT(b5, b4));
+#undef SELECT
+    }
+    expandRGB5A3Scalar(dst + i, src + i, count - i);
+}
+#endif
+
+/*
+  kernel selection (SSE2 is either always there or never there)
+*/
+struct texkernel_t {
+    const char *name;
+    expandfunc_t rgb565, rgba4444, rgb5a3;
+};
+
+static const texkernel_t scalarKernel = {
+    "scalar", expandRGB565Scalar, expandRGBA4444Scalar, expandRGB5A3Scalar
+};
+
+#ifdef TEXTURE_SSE2
+static const texkernel_t simdKernel = {
+    "sse2", expandRGB565SSE2, expandRGBA4444SSE2, expandRGB5A3SSE2
+};
+#else
+static const texkernel_t &simdKernel = scalarKernel;
+#endif
+
+const char* textureKernel() {
+    return simdKernel.name;
+}
+
+/*
+  Position of each pixel of an 8x8 3DS tile (in Z-order) within the tile
+*/
+struct zorder_t {
+    u8 offset[64];
+
+    zorder_t() {
+        for (u32 i = 0; i < 64; i++) {
+            u32 x = (i & 1) | ((i >> 1) & 2) | ((i >> 2) & 4);
+            u32 y = ((i >> 1) & 1) | ((i >> 2) & 2) | ((i >> 3) & 4);
+            offset[i] = y * 8 + x;
+        }
+    }
+};
+
+static const zorder_t zorder;
+
+/*
+  ETC1 block (already read as a 64-bit word) into a 4x4 area of a block,
+  with alpha from a 64-bit word of 4-bit values (or opaque, if there is none)
+  (both are stored column by column)
+*/
+static void decodeETC1(u32 *dst, u32 stride, u64 block, const u64 *alpha) {
+    static const int modifiers[8][2] = {
+        {2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183}
+    };
+
+    int base[2][3];
+    if (block & (1ull << 33)) {
+        // "differential" mode: 5-bit base color and a 3-bit signed delta
+        for (int c = 0; c < 3; c++) {
+            int color = (block >> (59 - 8 * c)) & 0x1F;
+            int delta = (block >> (56 - 8 * c)) & 0x7;
+            delta = (delta ^ 4) - 4;
+            base[0][c] = expand5(color);
+            base[1][c] = expand5((color + delta) & 0x1F);
+        }
+    } else {
+        // "individual" mode: two 4-bit base colors
+        for (int c = 0; c < 3; c++) {
+            base[0][c] = expand4((block >> (60 - 8 * c)) & 0xF);
+            base[1][c] = expand4((block >> (56 - 8 * c)) & 0xF);
+        }
+    }
+
+    const int *table[2] = {
+        modifiers[(block >> 37) & 7],
+        modifiers[(block >> 34) & 7]
+    };
+    bool flip = block & (1ull << 32);
+
+    for (u32 x = 0; x < 4; x++) {
+        for (u32 y = 0; y < 4; y++) {
+            u32 i = x * 4 + y;
+            u32 sub = flip ? (y >= 2) : (x >= 2);
+            u32 index = ((block >> (i + 15)) & 2) | ((block >> i) & 1);
+            int modifier = table[sub][index & 1];
+            if (index & 2) modifier = -modifier;
+
+            u32 a = alpha ? expand4((*alpha >> (4 * i)) & 0xF) : 0xFF;
+            dst[y * stride + x] = argb(a,
+                                       qBound(0, base[sub][0] + modifier, 255),
+                                       qBound(0, base[sub][1] + modifier, 255),
+                                       qBound(0, base[sub][2] + modifier, 255));
+        }
+    }
+}
+
+/*
+  CMPR sub-block (DXT1 with big-endian colors, leftmost pixel in the high
+  bits of each row) into a 4x4 area of a block
+*/
+static void decodeDXT1(u32 *dst, u32 stride, const u8 *src) {
+    u32 c0 = (src[0] << 8) | src[1];
+    u32 c1 = (src[2] << 8) | src[3];
+
+    u32 r[4], g[4], b[4], a[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+    r[0] = expand5(c0 >> 11); g[0] = expand6((c0 >> 5) & 0x3F); b[0] = expand5(c0 & 0x1F);
+    r[1] = expand5(c1 >> 11); g[1] = expand6((c1 >> 5) & 0x3F); b[1] = expand5(c1 & 0x1F);
+
+    if (c0 > c1) {
+        r[2] = (2 * r[0] + r[1]) / 3; r[3] = (r[0] + 2 * r[1]) / 3;
+        g[2] = (2 * g[0] + g[1]) / 3; g[3] = (g[0] + 2 * g[1]) / 3;
+        b[2] = (2 * b[0] + b[1]) / 3; b[3] = (b[0] + 2 * b[1]) / 3;
+    } else {
+        r[2] = (r[0] + r[1]) / 2; r[3] = 0;
+        g[2] = (g[0] + g[1]) / 2; g[3] = 0;
+        b[2] = (b[0] + b[1]) / 2; b[3] = 0;
+        a[3] = 0;
+    }
+
+    u32 colors[4];
+    for (u32 i = 0; i < 4; i++)
+        colors[i] = argb(a[i], r[i], g[i], b[i]);
+
+    for (u32 y = 0; y < 4; y++) {
+        u8 row = src[4 + y];
+        for (u32 x = 0; x < 4; x++)
+            dst[y * stride + x] = colors[(row >> (6 - 2 * x)) & 3];
+    }
+}
+
+/*
+  Decode one block of a texture into pixels in raster order
+*/
+static void decodeBlock(const texkernel_t &kernel, TextureFormat format,
+                        u32 *pixels, const u8 *src) {
+    u16 texels[MAX_BLOCK_PIXELS];
+    u32 zpixels[MAX_BLOCK_PIXELS];
+    // (offsets of the four 4x4 sub-blocks of an 8x8 block, in Z-order)
+    static const u32 quarters[4] = {0, 4, 32, 36};
+
+    switch (format) {
+    case TextureRGB565:
+    case TextureRGBA4444:
+        decode16<false>(texels, src, 64);
+        (format == TextureRGB565 ? kernel.rgb565 : kernel.rgba4444)(zpixels, texels, 64);
+        for (u32 i = 0; i < 64; i++)
+            pixels[zorder.offset[i]] = zpixels[i];
+        break;
+
+    case TextureETC1:
+    case TextureETC1A4:
+        for (u32 i = 0; i < 4; i++) {
+            u64 alpha, block;
+            if (format == TextureETC1A4) {
+                memcpy(&alpha, src, 8);
+                alpha = qFromLittleEndian(alpha);
+                src += 8;
+            }
+            memcpy(&block, src, 8);
+            block = qFromLittleEndian(block);
+            src += 8;
+
+            decodeETC1(pixels + quarters[i], 8, block,
+                       format == TextureETC1A4 ? &alpha : 0);
+        }
+        break;
+
+    case TextureRGB5A3:
+        decode16<true>(texels, src, 16);
+        kernel.rgb5a3(pixels, texels, 16);
+        break;
+
+    case TextureCMPR:
+        for (u32 i = 0; i < 4; i++, src += 8)
+            decodeDXT1(pixels + quarters[i], 8, src);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static bool decode(const texkernel_t &kernel, u32 *dst, size_t dstStride,
+                   const void *src, size_t srcSize,
+                   u32 width, u32 height, TextureFormat format) {
+    if (format >= NumTextureFormats || srcSize < textureSize(format, width, height))
+        return false;
+
+    const texformat_t &info = formats[format];
+    const u32 blockSize = info.blockWidth * info.blockHeight * info.bitsPerPixel / 8;
+    const u32 paddedWidth  = paddedTo(width, info.blockWidth);
+    const u32 paddedHeight = paddedTo(height, info.blockHeight);
+    const u8 *data = (const u8*)src;
+
+    u32 pixels[MAX_BLOCK_PIXELS];
+    for (u32 by = 0; by < paddedHeight; by += info.blockHeight) {
+        for (u32 bx = 0; bx < paddedWidth; bx += info.blockWidth, data += blockSize) {
+            decodeBlock(kernel, format, pixels, data);
+
+            // copy each row of the block to wherever it goes in the image
+            // (leaving out any padding)
+            if (bx >= width)
+                continue;
+            u32 columns = qMin(info.blockWidth, width - bx);
+            for (u32 y = 0; y < info.blockHeight; y++) {
+                u32 row = info.upsideDown ? paddedHeight - 1 - (by + y) : by + y;
+                if (row < height)
+                    memcpy(dst + row * dstStride + bx, pixels + y * info.blockWidth, 4 * columns);
+            }
+        }
+    }
+
+    return true;
+}
+
+bool decodeTexture(u32 *dst, size_t dstStride, const void *src, size_t srcSize,
+                   u32 width, u32 height, TextureFormat format) {
+    return decode(simdKernel, dst, dstStride, src, srcSize, width, height, format);
+}
+
+bool decodeTextureScalar(u32 *dst, size_t dstStride, const void *src, size_t srcSize,
+                         u32 width, u32 height, TextureFormat format) {
+    return decode(scalarKernel, dst, dstStride, src, srcSize, width, height, format);
+}
@@ -0,0 +1,54 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+  Texture formats used for tilesets:
+  3DS (Triple Deluxe) textures are little-endian, stored in 8x8 tiles with
+  the pixels in each tile in Z-order, and upside down;
+  Wii (Return to Dream Land) textures are big-endian, stored in 4x4 (RGB5A3)
+  or 8x8 (CMPR) blocks, right side up.
+*/
+enum TextureFormat {
+    TextureRGB565,
+    TextureRGBA4444,
+    TextureETC1,
+    TextureETC1A4,
+    TextureRGB5A3,
+    TextureCMPR,
+    NumTextureFormats
+};
+
+const char* textureFormatName(TextureFormat);
+
+// number of bytes of texture data for an image of a given size
+// (including padding out to whole blocks)
+size_t textureSize(TextureFormat, uint32_t width, uint32_t height);
+// height of the tallest image of a given width that fits in some amount of data
+uint32_t textureHeight(TextureFormat, uint32_t width, size_t dataSize);
+
+/*
+  Decode a texture into non-premultiplied ARGB32 pixels (same layout as
+  QRgb / QImage::Format_ARGB32). dstStride is in pixels, not bytes.
+  Returns false if there isn't enough data for an image of that size.
+
+  decodeTexture expands 16-bit texels with SSE2 if the CPU has it (one
+  whole block at a time); decodeTextureScalar is the plain C version, which
+  the SIMD one has to match exactly.
+*/
+bool decodeTexture(uint32_t *dst, size_t dstStride, const void *src, size_t srcSize,
+                   uint32_t width, uint32_t height, TextureFormat format);
+bool decodeTextureScalar(uint32_t *dst, size_t dstStride, const void *src, size_t srcSize,
+                         uint32_t width, uint32_t height, TextureFormat format);
+
+// name of the texel expanding kernel currently in use ("sse2" or "scalar")
+const char* textureKernel();
+
+#endif // TEXTURE_H
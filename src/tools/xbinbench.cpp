@@ -0,0 +1,244 @@
+/*
+  xbinbench.cpp
+
+  Map decoding benchmark: measures raw byte-swapping, layer compositing and
+  texture decoding throughput, and per-layer decode throughput for a set
+  of maps.
+
+  This code is released under the terms of the MIT license.
+  See COPYING.txt for details.
+*/
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMap>
+#include <QVector>
+
+#include <cstdio>
+
+#include "byteswap.h"
+#include "compositor.h"
+#include "level.h"
+#include "texture.h"
+
+// total bytes/time for one layer over all runs
+struct layertotal_t {
+    quint64 bytes;
+    qint64 nsecs;
+};
+
+static double mbPerSec(quint64 bytes, qint64 nsecs) {
+    return nsecs > 0 ? bytes * 1000.0 / nsecs : 0;
+}
+
+/*
+  Time the bulk decoders by themselves on a big synthetic buffer.
+*/
+static void benchKernels(int runs) {
+    const size_t size = 16 << 20;
+    QByteArray src((int)size, 0);
+    QByteArray dst((int)size, 0);
+    for (size_t i = 0; i < size; i++)
+        src[(int)i] = (char)(i * 31);
+
+    printf("byteswap kernel: %s\n", byteswapKernel());
+
+    for (int swap = 0; swap < 2; swap++) {
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+        bool bigEndian = !swap;
+#else
+        bool bigEndian = swap;
+#endif
+        QElapsedTimer timer;
+
+        timer.start();
+        for (int i = 0; i < runs; i++)
+            decode16(dst.data(), src.constData(), size / 2, bigEndian);
+        qint64 time16 = timer.nsecsElapsed();
+
+        timer.start();
+        for (int i = 0; i < runs; i++)
+            decode32(dst.data(), src.constData(), size / 4, bigEndian);
+        qint64 time32 = timer.nsecsElapsed();
+
+        printf("  %-8s decode16 %10.1f MB/s   decode32 %10.1f MB/s\n",
+               swap ? "swapped" : "native",
+               mbPerSec((quint64)size * runs, time16),
+               mbPerSec((quint64)size * runs, time32));
+    }
+}
+
+/*
+  Time the layer compositor on a big synthetic map, and make sure the
+  SIMD kernel gives exactly the same results as the scalar one.
+*/
+static bool benchCompositor(int runs) {
+    const uint width = 1024, height = 1024, numLayers = 5;
+
+    QVector<uint32_t> palettes(numLayers * COMPOSITE_PALETTE_SIZE);
+    QByteArray indices(numLayers * width * height, 0);
+    uint seed = 1;
+    for (int i = 0; i < palettes.size(); i++) {
+        // random premultiplied colors (some opaque, some translucent)
+        seed = seed * 1103515245 + 12345;
+        uint alpha = (i % COMPOSITE_PALETTE_SIZE) ? ((seed >> 16) & 1 ? 255 : 128) : 0;
+        uint color = (seed >> 8) & 0xFF;
+        palettes[i] = (alpha << 24) | ((color * alpha / 255) * 0x010101);
+    }
+    for (int i = 0; i < indices.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        indices[i] = (char)(seed >> 16);
+    }
+
+    complayer_t layers[numLayers];
+    for (uint i = 0; i < numLayers; i++) {
+        layers[i].indices = (const uint8_t*)indices.constData() + i * width * height;
+        layers[i].stride = width;
+        layers[i].palette = palettes.constData() + i * COMPOSITE_PALETTE_SIZE;
+    }
+
+    QVector<uint32_t> simd(width * height), scalar(width * height);
+    QElapsedTimer timer;
+
+    timer.start();
+    for (int i = 0; i < runs; i++)
+        compositeLayers(simd.data(), width, width, height, layers, numLayers);
+    qint64 simdTime = timer.nsecsElapsed();
+
+    timer.start();
+    for (int i = 0; i < runs; i++)
+        compositeLayersScalar(scalar.data(), width, width, height, layers, numLayers);
+    qint64 scalarTime = timer.nsecsElapsed();
+
+    bool match = simd == scalar;
+    printf("compositor kernel: %s (%u layers)\n", compositorKernel(), numLayers);
+    printf("  %-8s %10.1f Mpixel/s\n", compositorKernel(),
+           mbPerSec((quint64)width * height * runs, simdTime));
+    printf("  %-8s %10.1f Mpixel/s\n", "scalar",
+           mbPerSec((quint64)width * height * runs, scalarTime));
+    if (!match)
+        printf("  results don't match the scalar compositor!\n");
+
+    return match;
+}
+
+/*
+  Time each texture decoder on random data, and make sure the SIMD texel
+  expansion gives exactly the same results as the scalar one.
+*/
+static bool benchTextures(int runs) {
+    const uint width = 1024, height = 1024;
+    bool ok = true;
+
+    printf("texture kernel: %s\n", textureKernel());
+
+    QVector<uint32_t> simd(width * height), scalar(width * height);
+    for (int i = 0; i < NumTextureFormats; i++) {
+        TextureFormat format = (TextureFormat)i;
+        QByteArray data(textureSize(format, width, height), 0);
+        uint seed = i + 1;
+        for (int j = 0; j < data.size(); j++) {
+            seed = seed * 1103515245 + 12345;
+            data[j] = (char)(seed >> 16);
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        for (int j = 0; j < runs; j++)
+            decodeTexture(simd.data(), width, data.constData(), data.size(), width, height, format);
+        qint64 time = timer.nsecsElapsed();
+
+        decodeTextureScalar(scalar.data(), width, data.constData(), data.size(), width, height, format);
+        bool match = simd == scalar;
+        ok &= match;
+
+        printf("  %-16s %10.1f Mpixel/s%s\n", textureFormatName(format),
+               mbPerSec((quint64)width * height * runs, time),
+               match ? "" : " (doesn't match the scalar decoder!)");
+    }
+
+    return ok;
+}
+
+/*
+  Open a map over and over and total up how long each layer took.
+*/
+static bool benchMap(const QString &path, int runs) {
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly)) {
+        printf("%s: unable to open file\n", qPrintable(path));
+        return false;
+    }
+
+    QMap<QString, layertotal_t> totals;
+    QStringList order;
+    qint64 openTime = 0;
+    qint64 entityTime = 0;
+    const char *format = "unknown";
+
+    for (int i = 0; i < runs; i++) {
+        LevelData level;
+        QElapsedTimer timer;
+        timer.start();
+        if (!level.open(file)) {
+            printf("%s: %s\n", qPrintable(path), level.errorString());
+            return false;
+        }
+        openTime += timer.nsecsElapsed();
+        // (entity chunks aren't decoded until they're needed, so time
+        //  those separately)
+        timer.start();
+        level.loadAll();
+        entityTime += timer.nsecsElapsed();
+        format = level.formatName();
+
+        foreach (const decodestat_t &stat, level.decodeStats()) {
+            if (!totals.contains(stat.name)) {
+                layertotal_t total = {0, 0};
+                totals[stat.name] = total;
+                order.append(stat.name);
+            }
+            totals[stat.name].bytes += stat.bytes;
+            totals[stat.name].nsecs += stat.nsecs;
+        }
+    }
+
+    printf("%s (%s): %.3f ms per open, %.3f ms for entities\n", qPrintable(path), format,
+           openTime / 1000000.0 / runs, entityTime / 1000000.0 / runs);
+    foreach (const QString &name, order) {
+        const layertotal_t &total = totals[name];
+        printf("  %-10s %10llu bytes %10.1f MB/s\n", qPrintable(name),
+               (unsigned long long)(total.bytes / runs),
+               mbPerSec(total.bytes, total.nsecs));
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("xbinbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures map decoding throughput.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("maps", "Map files to decode.", "[map...]");
+
+    QCommandLineOption runsOption(QStringList() << "n" << "runs",
+                                  "Repeat each measurement <n> times (default: 10).", "n", "10");
+    parser.addOption(runsOption);
+    parser.process(app);
+
+    int runs = qMax(1, parser.value(runsOption).toInt());
+
+    benchKernels(runs);
+    bool ok = benchCompositor(runs);
+    ok &= benchTextures(runs);
+
+    foreach (const QString &path, parser.positionalArguments())
+        ok &= benchMap(path, runs);
+
+    return ok ? 0 : 1;
+}
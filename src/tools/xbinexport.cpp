@@ -0,0 +1,268 @@
+/*
+  xbinexport.cpp
+
+  Headless map exporter: renders every XBIN map under one or more
+  directories (e.g. a whole RomFS dump) to a full size PNG, several maps
+  at once.
+
+  This code is released under the terms of the MIT license.
+  See COPYING.txt for details.
+*/
+
+#include <QGuiApplication>
+#include <QAtomicInt>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QSemaphore>
+#include <QThreadPool>
+
+#include <cstdio>
+
+#include "level.h"
+#include "maprenderer.h"
+#include "texture.h"
+
+// what to draw on every map
+struct exportoptions_t {
+    QDir outDir;
+    uint layers, entityKinds;
+    QImage tileset;
+    bool verbose;
+};
+
+static QAtomicInt exported, failed;
+
+/*
+  Render one map to a PNG in the output directory, in the same place
+  relative to it as the map is to the directory it was found in.
+  (each map is rendered a band at a time, so running one of these on every
+   core only needs a band's worth of memory for each one)
+*/
+class ExportTask : public QRunnable {
+public:
+    ExportTask(const QString &path, const QString &outPath,
+               const exportoptions_t *options, QSemaphore *queueSlots)
+        : path(path), outPath(outPath), options(options), queueSlots(queueSlots) {}
+
+    void run() {
+        QString error;
+        int result = exportMap(error);
+        if (result > 0) {
+            exported.fetchAndAddOrdered(1);
+            if (options->verbose)
+                fprintf(stderr, "%s -> %s\n", qPrintable(path), qPrintable(outPath));
+        } else if (result < 0) {
+            failed.fetchAndAddOrdered(1);
+            fprintf(stderr, "%s: %s\n", qPrintable(path), qPrintable(error));
+        }
+        queueSlots->release();
+    }
+
+private:
+    QString path, outPath;
+    const exportoptions_t *options;
+    QSemaphore *queueSlots;
+
+    // 1 if exported, 0 if not a map at all, -1 if something went wrong
+    int exportMap(QString &error) const {
+        QFile file(path);
+        if (!file.open(QFile::ReadOnly)) {
+            error = file.errorString();
+            return -1;
+        }
+
+        LevelData level;
+        if (!level.open(file)) {
+            // dumps are full of other .dat files, so just skip those
+            if (level.error == ErrorNotMap)
+                return 0;
+            error = level.errorString();
+            return -1;
+        }
+
+        if (!QDir().mkpath(QFileInfo(outPath).path())) {
+            error = "Unable to create the output directory.";
+            return -1;
+        }
+
+        QSaveFile out(outPath);
+        if (!out.open(QIODevice::WriteOnly)) {
+            error = out.errorString();
+            return -1;
+        }
+
+        MapRenderer renderer(level, options->layers, options->entityKinds, options->tileset);
+        if (!renderer.writePng(&out, &error))
+            return -1;
+        if (!out.commit()) {
+            error = out.errorString();
+            return -1;
+        }
+
+        return 1;
+    }
+};
+
+/*
+  Parse a comma-separated list of names into a mask of bits
+*/
+static bool parseMask(const QString &list, const char *const *names, uint count, uint &mask) {
+    mask = 0;
+    foreach (const QString &name, list.split(',', QString::SkipEmptyParts)) {
+        uint i;
+        for (i = 0; i < count; i++) {
+            if (name.trimmed() == names[i])
+                break;
+        }
+        if (i == count)
+            return false;
+        mask |= 1 << i;
+    }
+    return true;
+}
+
+/*
+  Load a raw tileset texture, the same as File > Load Tileset in the viewer
+*/
+static bool loadTileset(const QString &path, const QString &formatName, int width, QImage &image) {
+    int format;
+    for (format = 0; format < NumTextureFormats; format++) {
+        if (QString(textureFormatName((TextureFormat)format)).startsWith(formatName, Qt::CaseInsensitive))
+            break;
+    }
+    if (format == NumTextureFormats || width <= 0) {
+        fprintf(stderr, "unknown tileset format or width\n");
+        return false;
+    }
+
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly)) {
+        fprintf(stderr, "unable to open %s\n", qPrintable(path));
+        return false;
+    }
+    QByteArray data = file.readAll();
+
+    uint height = textureHeight((TextureFormat)format, width, data.size());
+    image = QImage(width, height, QImage::Format_ARGB32);
+    if (!height
+        || !decodeTexture((uint32_t*)image.bits(), image.bytesPerLine() / 4,
+                          data.constData(), data.size(), width, height, (TextureFormat)format)) {
+        fprintf(stderr, "%s is too small for a texture %d pixels wide\n", qPrintable(path), width);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    // (fonts for the entity labels need a GUI application, but not a display)
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QGuiApplication app(argc, argv);
+    QGuiApplication::setApplicationName("xbinexport");
+
+    static const char *const layerNames[NumLayers] = {
+        "visual0", "visual1", "visual2", "collision", "breakable"
+    };
+    static const char *const entityNames[NumEntityKinds] = {
+        "objects", "items", "enemies"
+    };
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders every XBIN map (*.dat) under the given "
+                                     "directories to a PNG at actual size.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("dirs", "Directories to export.", "<dir>...");
+
+    QCommandLineOption outputOption(QStringList() << "o" << "output",
+                                    "Write images under <dir> (required).", "dir");
+    QCommandLineOption jobsOption(QStringList() << "j" << "jobs",
+                                  "Export <n> maps at once (default: one per core).", "n");
+    QCommandLineOption layersOption("layers",
+                                    "Layers to draw (any of visual0, visual1, visual2, "
+                                    "collision, breakable; default: all).", "list");
+    QCommandLineOption entitiesOption("entities",
+                                      "Entities to label (any of objects, items, enemies; "
+                                      "default: all).", "list");
+    QCommandLineOption tilesetOption("tileset",
+                                     "Draw visual layers using a raw tileset texture.", "file");
+    QCommandLineOption formatOption("tileset-format",
+                                    "Format of the tileset texture (RGB565, RGBA4444, ETC1, "
+                                    "ETC1A4, RGB5A3 or CMPR; default: ETC1).", "format", "ETC1");
+    QCommandLineOption widthOption("tileset-width",
+                                   "Width of the tileset texture (default: 256).", "pixels", "256");
+    QCommandLineOption verboseOption(QStringList() << "v" << "verbose",
+                                     "List each map as it's exported.");
+    parser.addOption(outputOption);
+    parser.addOption(jobsOption);
+    parser.addOption(layersOption);
+    parser.addOption(entitiesOption);
+    parser.addOption(tilesetOption);
+    parser.addOption(formatOption);
+    parser.addOption(widthOption);
+    parser.addOption(verboseOption);
+    parser.process(app);
+
+    QStringList dirs = parser.positionalArguments();
+    if (dirs.isEmpty() || !parser.isSet(outputOption))
+        parser.showHelp(1);
+
+    exportoptions_t options;
+    options.outDir = QDir(parser.value(outputOption));
+    options.layers = ALL_LAYERS;
+    options.entityKinds = ALL_ENTITIES;
+    options.verbose = parser.isSet(verboseOption);
+
+    if (parser.isSet(layersOption)
+        && !parseMask(parser.value(layersOption), layerNames, NumLayers, options.layers)) {
+        fprintf(stderr, "unknown layer in %s\n", qPrintable(parser.value(layersOption)));
+        return 1;
+    }
+    if (parser.isSet(entitiesOption)
+        && !parseMask(parser.value(entitiesOption), entityNames, NumEntityKinds, options.entityKinds)) {
+        fprintf(stderr, "unknown entity kind in %s\n", qPrintable(parser.value(entitiesOption)));
+        return 1;
+    }
+    if (parser.isSet(tilesetOption)
+        && !loadTileset(parser.value(tilesetOption), parser.value(formatOption),
+                        parser.value(widthOption).toInt(), options.tileset))
+        return 1;
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    if (parser.isSet(jobsOption))
+        pool->setMaxThreadCount(qMax(1, parser.value(jobsOption).toInt()));
+
+    // (same as xbinscan: only a few maps per thread are queued up at a time)
+    QSemaphore queueSlots(4 * pool->maxThreadCount());
+
+    QElapsedTimer timer;
+    timer.start();
+
+    foreach (const QString &dir, dirs) {
+        QDir root(dir);
+        QDirIterator it(dir, QStringList() << "*.dat", QDir::Files,
+                        QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            QString path = it.next();
+            QString relative = root.relativeFilePath(path);
+            relative.chop(4);
+            relative += ".png";
+
+            queueSlots.acquire();
+            pool->start(new ExportTask(path, options.outDir.filePath(relative), &options, &queueSlots));
+        }
+    }
+
+    pool->waitForDone();
+
+    fprintf(stderr, "%d maps exported (%d failed) in %.2f sec\n",
+            exported.load(), failed.load(), timer.elapsed() / 1000.0);
+
+    return failed.load() ? 1 : 0;
+}
@@ -0,0 +1,267 @@
+/*
+  xbinscan.cpp
+
+  Headless batch scanner: parses every XBIN map under one or more
+  directories (e.g. a whole RomFS dump) and writes one record per map.
+
+  This code is released under the terms of the MIT license.
+  See COPYING.txt for details.
+*/
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+
+#include <cstdio>
+
+#include "level.h"
+
+// info about one scanned map
+struct scanresult_t {
+    QString path;
+    QString error;
+    const char *format;
+    uint width, height;
+    int enemies, enemyTypes, objects, items;
+    QString music;
+    double parseMsecs;
+    bool isMap;
+};
+
+/*
+  Writes each record as soon as it's ready (from whichever thread scanned
+  the map) instead of holding on to results for the whole dump.
+*/
+class ResultWriter {
+public:
+    ResultWriter(FILE *out, bool csv)
+        : out(out), csv(csv), count(0)
+    {
+        if (csv) {
+            fputs("path,format,width,height,enemies,enemy_types,objects,items,"
+                  "music,parse_ms,error\n", out);
+        }
+    }
+
+    void write(const scanresult_t &result) {
+        QByteArray line = csv ? csvRecord(result) : jsonRecord(result);
+
+        QMutexLocker lock(&mutex);
+        fwrite(line.constData(), 1, line.size(), out);
+        fflush(out);
+        count++;
+    }
+
+    int written() const { return count; }
+
+private:
+    static QByteArray jsonRecord(const scanresult_t &result) {
+        QJsonObject record;
+        record["path"] = result.path;
+        record["format"] = result.format;
+        if (result.error.isEmpty()) {
+            record["width"] = (int)result.width;
+            record["height"] = (int)result.height;
+            record["enemies"] = result.enemies;
+            record["enemy_types"] = result.enemyTypes;
+            record["objects"] = result.objects;
+            record["items"] = result.items;
+            record["music"] = result.music;
+        } else {
+            record["error"] = result.error;
+        }
+        record["parse_ms"] = result.parseMsecs;
+
+        return QJsonDocument(record).toJson(QJsonDocument::Compact) + '\n';
+    }
+
+    static QByteArray csvField(const QString &field) {
+        QByteArray bytes = field.toUtf8();
+        if (bytes.contains(',') || bytes.contains('"') || bytes.contains('\n'))
+            bytes = '"' + bytes.replace('"', "\"\"") + '"';
+        return bytes;
+    }
+
+    static QByteArray csvRecord(const scanresult_t &result) {
+        QStringList fields;
+        fields << result.path << result.format
+               << QString::number(result.width) << QString::number(result.height)
+               << QString::number(result.enemies) << QString::number(result.enemyTypes)
+               << QString::number(result.objects) << QString::number(result.items)
+               << result.music << QString::number(result.parseMsecs, 'f', 3)
+               << result.error;
+
+        QByteArray line;
+        for (int i = 0; i < fields.size(); i++) {
+            if (i) line += ',';
+            line += csvField(fields[i]);
+        }
+        return line + '\n';
+    }
+
+    QMutex mutex;
+    FILE *out;
+    bool csv;
+    int count;
+};
+
+/*
+  Parse a single map and collect some info about it.
+*/
+static bool verbose = false;
+static bool dimensionsOnly = false;
+
+static scanresult_t scanMap(const QString &path) {
+    scanresult_t result;
+    result.path = path;
+    result.format = "unknown";
+    result.width = result.height = 0;
+    result.enemies = result.enemyTypes = result.objects = result.items = 0;
+    result.parseMsecs = 0;
+    result.isMap = false;
+
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly)) {
+        result.isMap = true;
+        result.error = "Unable to open file.";
+        return result;
+    }
+
+    LevelData level;
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = level.open(file);
+
+    // dumps are full of other .dat files, so just skip those
+    if (level.error == ErrorNotMap)
+        return result;
+    result.isMap = true;
+
+    if (!ok) {
+        result.parseMsecs = timer.nsecsElapsed() / 1000000.0;
+        result.error = level.errorString();
+        return result;
+    }
+
+    result.format = level.formatName();
+    result.width = level.width;
+    result.height = level.height;
+    // (entity chunks are only decoded when they're asked for)
+    if (!dimensionsOnly) {
+        result.enemies = level.enemies().size();
+        result.enemyTypes = level.enemyTypes().size();
+        result.objects = level.objects().size();
+        result.items = level.items().size();
+        result.music = level.musicName();
+    }
+    result.parseMsecs = timer.nsecsElapsed() / 1000000.0;
+
+    if (verbose) {
+        foreach (const QString &warning, level.warnings())
+            fprintf(stderr, "%s: %s\n", qPrintable(path), qPrintable(warning));
+    }
+
+    return result;
+}
+
+class ScanTask : public QRunnable {
+public:
+    ScanTask(const QString &path, ResultWriter *writer, QSemaphore *queueSlots)
+        : path(path), writer(writer), queueSlots(queueSlots) {}
+
+    void run() {
+        scanresult_t result = scanMap(path);
+        if (result.isMap)
+            writer->write(result);
+        queueSlots->release();
+    }
+
+private:
+    QString path;
+    ResultWriter *writer;
+    QSemaphore *queueSlots;
+};
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("xbinscan");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Parses every XBIN map (*.dat) under the given "
+                                     "directories and writes one record per map.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("dirs", "Directories to scan.", "<dir>...");
+
+    QCommandLineOption csvOption("csv", "Write CSV instead of JSON lines.");
+    QCommandLineOption outputOption(QStringList() << "o" << "output",
+                                    "Write records to <file> instead of stdout.", "file");
+    QCommandLineOption jobsOption(QStringList() << "j" << "jobs",
+                                  "Parse <n> maps at once (default: one per core).", "n");
+    QCommandLineOption verboseOption(QStringList() << "v" << "verbose",
+                                     "Show parser warnings.");
+    QCommandLineOption dimensionsOption("dimensions-only",
+                                        "Only read map formats and dimensions (skips entities and music).");
+    parser.addOption(csvOption);
+    parser.addOption(outputOption);
+    parser.addOption(jobsOption);
+    parser.addOption(verboseOption);
+    parser.addOption(dimensionsOption);
+    parser.process(app);
+
+    QStringList dirs = parser.positionalArguments();
+    if (dirs.isEmpty())
+        parser.showHelp(1);
+
+    verbose = parser.isSet(verboseOption);
+    dimensionsOnly = parser.isSet(dimensionsOption);
+
+    FILE *out = stdout;
+    if (parser.isSet(outputOption)) {
+        out = fopen(QFile::encodeName(parser.value(outputOption)).constData(), "wb");
+        if (!out) {
+            fprintf(stderr, "unable to open %s for writing\n",
+                    qPrintable(parser.value(outputOption)));
+            return 1;
+        }
+    }
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    if (parser.isSet(jobsOption))
+        pool->setMaxThreadCount(qMax(1, parser.value(jobsOption).toInt()));
+
+    // every worker pulls the next map off the pool's queue as soon as it's
+    // done with the last one; only a few maps per thread are queued up at
+    // a time so the directory walk doesn't run away from the parsing
+    QSemaphore queueSlots(4 * pool->maxThreadCount());
+    ResultWriter writer(out, parser.isSet(csvOption));
+
+    QElapsedTimer timer;
+    timer.start();
+
+    foreach (const QString &dir, dirs) {
+        QDirIterator it(dir, QStringList() << "*.dat", QDir::Files,
+                        QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            QString path = it.next();
+            queueSlots.acquire();
+            pool->start(new ScanTask(path, &writer, &queueSlots));
+        }
+    }
+
+    pool->waitForDone();
+
+    fprintf(stderr, "%d maps scanned in %.2f sec\n",
+            writer.written(), timer.elapsed() / 1000.0);
+
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,63 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#include <QFile>
+#include <cstring>
+#include "xbinfile.h"
+
+XBinFile::XBinFile()
+    : mapped(0),
+      bytes(0), length(0), bigEndian(false)
+{}
+
+XBinFile::~XBinFile() {
+    close();
+}
+
+bool XBinFile::open(const QString &fileName) {
+    close();
+
+    file.setFileName(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+
+    qint64 size = file.size();
+    if (size < 6 || size > 0xFFFFFFFF) {
+        file.close();
+        return false;
+    }
+
+    // map the whole file once...
+    this->mapped = file.map(0, size);
+    if (this->mapped) {
+        this->bytes = this->mapped;
+    } else {
+        // ...or just read the whole thing if it can't be mapped
+        this->buffer = file.readAll();
+        file.close();
+        if (this->buffer.size() != size) {
+            this->buffer.clear();
+            return false;
+        }
+        this->bytes = (const uchar*)this->buffer.constData();
+    }
+
+    this->length = size;
+    this->bigEndian = bytes[4] == 0x12 && bytes[5] == 0x34;
+    return true;
+}
+
+void XBinFile::close() {
+    if (this->mapped)
+        file.unmap(this->mapped);
+    file.close();
+
+    this->mapped = 0;
+    this->buffer.clear();
+
+    this->bytes = 0;
+    this->length = 0;
+    this->bigEndian = false;
+}
@@ -0,0 +1,161 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef XBINFILE_H
+#define XBINFILE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QtEndian>
+#include <cstdint>
+#include <cstring>
+
+#include "byteswap.h"
+
+#define CHUNK_TABLE 0x14
+
+typedef uint16_t u16;
+typedef int16_t i16;
+typedef uint32_t u32;
+typedef int32_t i32;
+
+/*
+  Lightweight read cursor over the bytes of a mapped XBIN file.
+  Cursors are cheap to copy, so each chunk loader can have its own.
+  The file's byte order is a template parameter, so none of the reads
+  have to check it at runtime.
+  Reads past the end of the data return zero instead of touching
+  anything outside of the mapping.
+*/
+template <bool bigEndian> class XBinCursor {
+public:
+    XBinCursor(const uchar *data = 0, uint size = 0, uint pos = 0)
+        : data(data), size(size), cursor(pos) {}
+
+    uint pos() const  { return cursor; }
+    // how much data there is past the cursor (for bounding counts from the file)
+    uint bytesLeft() const { return cursor < size ? size - cursor : 0; }
+    void seek(uint pos) { cursor = pos; }
+    void skip(uint bytes) { cursor += bytes; }
+
+    template <typename type> type peek(uint pos) const {
+        if (pos > size || size - pos < sizeof(type))
+            return 0;
+
+        return bigEndian ? qFromBigEndian<type>(data + pos)
+                         : qFromLittleEndian<type>(data + pos);
+    }
+
+    template <typename type> type read() {
+        type num = peek<type>(cursor);
+        cursor += sizeof(type);
+        return num;
+    }
+
+    // (shorthands for the above, since chunk loaders are templates too and
+    //  would otherwise have to write cursor.template read<u32>())
+    u16 read16() { return read<u16>(); }
+    u32 read32() { return read<u32>(); }
+
+    // chunk table access
+    uint chunkOffset(uint chunk) const {
+        return peek<u32>(CHUNK_TABLE + (4 * chunk));
+    }
+
+    void seekChunk(uint chunk) {
+        cursor = chunkOffset(chunk);
+    }
+
+    // bulk reads of arrays of 16/32-bit words (see byteswap.h)
+    // these return false and zero-fill dst if the data runs past the end
+    bool readWords16(void *dst, uint count) {
+        quint64 bytes = 2 * (quint64)count;
+        bool ok = fits(bytes);
+        if (ok)
+            decode16<bigEndian>(dst, data + cursor, count);
+        else
+            memset(dst, 0, bytes);
+        cursor += bytes;
+        return ok;
+    }
+
+    bool readWords32(void *dst, uint count) {
+        quint64 bytes = 4 * (quint64)count;
+        bool ok = fits(bytes);
+        if (ok)
+            decode32<bigEndian>(dst, data + cursor, count);
+        else
+            memset(dst, 0, bytes);
+        cursor += bytes;
+        return ok;
+    }
+
+    // length-prefixed strings (returned as views into the mapped data,
+    // so nothing is copied until the caller actually converts them)
+    QByteArray readString() {
+        QByteArray str = stringAt(cursor);
+        cursor += 4 + str.size();
+        return str;
+    }
+
+    QByteArray stringAt(uint ptr) const {
+        uint length = peek<u32>(ptr);
+
+        // ignore strings that would run past the end of the file
+        if (ptr > size || size - ptr < 4 || size - ptr - 4 < length)
+            return QByteArray();
+
+        return QByteArray::fromRawData((const char*)data + ptr + 4, length);
+    }
+
+private:
+    bool fits(quint64 bytes) const {
+        return cursor <= size && size - cursor >= bytes;
+    }
+
+    const uchar *data;
+    uint size;
+    uint cursor;
+};
+
+/*
+  A whole XBIN file mapped into memory (or read in one go, if the file
+  can't be mapped for whatever reason).
+  The file stays open (and mapped) until close() is called, so cursors and
+  string views from it stay valid until then.
+*/
+class XBinFile {
+public:
+    XBinFile();
+    ~XBinFile();
+
+    bool open(const QString &fileName);
+    void close();
+
+    bool isOpen() const { return bytes != 0; }
+    bool isBigEndian() const { return bigEndian; }
+
+    const uchar* data() const { return bytes; }
+    uint size() const { return length; }
+
+    // (the cursor's byte order has to match the file's)
+    template <bool bigEndianData> XBinCursor<bigEndianData> cursor(uint pos = 0) const {
+        Q_ASSERT(bigEndianData == bigEndian);
+        return XBinCursor<bigEndianData>(bytes, length, pos);
+    }
+
+private:
+    Q_DISABLE_COPY(XBinFile)
+
+    QFile file;
+    uchar *mapped;
+    QByteArray buffer;
+
+    const uchar *bytes;
+    uint length;
+    bool bigEndian;
+};
+
+#endif // XBINFILE_H
@@ -1,41 +1,24 @@
-QT       += core gui
-
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
-
-QMAKE_CFLAGS += -std=c99
-QMAKE_CXXFLAGS += -std=c++11
-
-TARGET = tristar
-TEMPLATE = app
-CONFIG += c++11
-
-# OS-specific metadata and stuff
-win32:RC_FILE = src/windows.rc
-
-# build on OS X with xcode/clang and libc++
-macx:QMAKE_CXXFLAGS += -stdlib=libc++
-
-SOURCES += \
-    src/mapscene.cpp \
-    src/mainwindow.cpp \
-    src/main.cpp \
-    src/level.cpp \
-    src/objectwindow.cpp
-    
-HEADERS  += \
-    src/mapscene.h \
-    src/mainwindow.h \
-    src/version.h \
-    src/level.h \
-    src/objectwindow.h
-    
-FORMS += \
-    src/mainwindow.ui \
-    src/objectwindow.ui
-
-RESOURCES += \
-    src/icons.qrc
+TEMPLATE = subdirs
+
+# map parsing core library
+SUBDIRS += core
+core.file = core.pro
+
+# the map viewer itself
+SUBDIRS += app
+app.file = app.pro
+app.depends = core
+
+# command-line tools
+SUBDIRS += xbinscan xbinbench xbinexport
+xbinscan.file = xbinscan.pro
+xbinscan.depends = core
+xbinbench.file = xbinbench.pro
+xbinbench.depends = core
+xbinexport.file = xbinexport.pro
+xbinexport.depends = core
 
 OTHER_FILES += \
-    src/windows.rc \
-    README.txt
+    common.pri \
+    core.pri \
+    README.md
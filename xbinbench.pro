@@ -0,0 +1,14 @@
+# map decoding benchmark
+
+QT       = core
+
+include(common.pri)
+include(core.pri)
+
+TARGET = xbinbench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+SOURCES += \
+    src/tools/xbinbench.cpp
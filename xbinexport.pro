@@ -0,0 +1,18 @@
+# headless full-size map image exporter for whole directories of maps
+
+QT       = core gui
+
+include(common.pri)
+include(core.pri)
+
+TARGET = xbinexport
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+SOURCES += \
+    src/maprenderer.cpp \
+    src/tools/xbinexport.cpp
+
+HEADERS += \
+    src/maprenderer.h
@@ -0,0 +1,14 @@
+# headless batch scanner for whole directories of maps
+
+QT       = core
+
+include(common.pri)
+include(core.pri)
+
+TARGET = xbinscan
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+SOURCES += \
+    src/tools/xbinscan.cpp